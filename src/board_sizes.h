@@ -0,0 +1,28 @@
+#ifndef LINJAT_BOARD_SIZES_H
+#define LINJAT_BOARD_SIZES_H
+
+// The board sizes (height, width, pieces) that the library can solve
+// and generate, in addition to the one given with -DMAP_HEIGHT etc.
+// These are the sizes in gen.manifest. Each one is a separate
+// instantiation of Game and the generator, so add sizes only as needed.
+#define LINJAT_BOARD_SIZES(SIZE) \
+    SIZE(9, 6, 7)                \
+    SIZE(9, 6, 8)                \
+    SIZE(9, 6, 9)                \
+    SIZE(9, 6, 10)               \
+    SIZE(10, 7, 15)              \
+    SIZE(10, 7, 16)              \
+    SIZE(10, 7, 17)              \
+    SIZE(10, 7, 18)              \
+    SIZE(10, 7, 19)              \
+    SIZE(10, 7, 20)              \
+    SIZE(11, 8, 19)              \
+    SIZE(11, 8, 20)              \
+    SIZE(11, 8, 21)              \
+    SIZE(11, 8, 22)              \
+    SIZE(13, 9, 23)              \
+    SIZE(13, 9, 24)              \
+    SIZE(13, 9, 25)              \
+    SIZE(13, 9, 26)
+
+#endif // LINJAT_BOARD_SIZES_H
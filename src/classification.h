@@ -0,0 +1,293 @@
+#ifndef LINJAT_CLASSIFICATION_H
+#define LINJAT_CLASSIFICATION_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct SolutionMetaData {
+    int depth = 0;
+    int max_width = 0;
+
+    void print(const std::string& prefix, const std::string& suffix,
+               FILE* fp = stdout) const {
+        fprintf(fp, "%s", prefix.c_str());
+
+        fprintf(fp, "\"depth\": %d, ", depth);
+        fprintf(fp, "\"max_width\": %d", max_width);
+
+        fprintf(fp, "%s", suffix.c_str());
+    }
+};
+
+struct Classification {
+    SolutionMetaData all;
+    SolutionMetaData one_of;
+    SolutionMetaData dep;
+    SolutionMetaData square;
+    SolutionMetaData cant_fit;
+    SolutionMetaData cover;
+    SolutionMetaData single_solution;
+    SolutionMetaData uncontested_no_cover;
+
+    bool solved = false;
+
+    void print(const std::string& prefix, const std::string& suffix,
+               FILE* fp = stdout) const {
+        fprintf(fp, "%s", prefix.c_str());
+
+        all.print("\"all\": {", "}, ", fp);
+        one_of.print("\"one_of\": {", "}, ", fp);
+        dep.print("\"dep\": {", "}, ", fp);
+        square.print("\"square\": {", "}, ", fp);
+        cant_fit.print("\"cant_fit\": {", "}, ", fp);
+        cover.print("\"cover\": {", "},", fp);
+        single_solution.print("\"single-solution\": {", "},", fp);
+        uncontested_no_cover.print("\"uncontested-no-cover\": {", "}", fp);
+        fprintf(fp, "%s", suffix.c_str());
+    }
+
+    // Look up a component by the name used in the JSON output, e.g.
+    // "dep" or "single-solution".
+    SolutionMetaData* component(const std::string& name) {
+        static const std::map<std::string, SolutionMetaData Classification::*>
+            components = {
+            { "all", &Classification::all },
+            { "one_of", &Classification::one_of },
+            { "dep", &Classification::dep },
+            { "square", &Classification::square },
+            { "cant_fit", &Classification::cant_fit },
+            { "cover", &Classification::cover },
+            { "single-solution", &Classification::single_solution },
+            { "uncontested-no-cover", &Classification::uncontested_no_cover },
+        };
+        auto it = components.find(name);
+        if (it == components.end()) {
+            return nullptr;
+        }
+        return &(this->*(it->second));
+    }
+
+    // Look up a field by the name used in the JSON output, e.g.
+    // "dep.depth" or "all.max_width".
+    bool field(const std::string& name, int* value) const {
+        size_t dot = name.find('.');
+        if (dot == std::string::npos) {
+            return false;
+        }
+        const SolutionMetaData* component =
+            const_cast<Classification*>(this)->component(name.substr(0, dot));
+        if (!component) {
+            return false;
+        }
+        std::string metric = name.substr(dot + 1);
+        if (metric == "depth") {
+            *value = component->depth;
+        } else if (metric == "max_width") {
+            *value = component->max_width;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // Every component's depth and max_width on one line, in the same
+    // order as print(). Used in golden files.
+    std::string compact() const {
+        const SolutionMetaData* components[] = {
+            &all, &one_of, &dep, &square, &cant_fit, &cover,
+            &single_solution, &uncontested_no_cover,
+        };
+        std::string ret;
+        for (const auto* component : components) {
+            ret += (ret.empty() ? "" : " ") +
+                std::to_string(component->depth) + " " +
+                std::to_string(component->max_width);
+        }
+        return ret;
+    }
+};
+
+// A weighted sum of classification fields, used to rank puzzles the
+// same way build-puzzle-collection.pl does. The pseudo-field "const"
+// is always 1. Terms are summed in the order given.
+class ScoreFormula {
+public:
+    // Parse "field=weight,...". Returns false, after printing the term
+    // that isn't one, on an error.
+    static bool parse(const std::string& spec, ScoreFormula* formula) {
+        formula->terms_.clear();
+        size_t start = 0;
+        while (start < spec.size()) {
+            size_t end = std::min(spec.find(',', start), spec.size());
+            std::string term = spec.substr(start, end - start);
+            size_t eq = term.find('=');
+            int dummy;
+            if (eq == std::string::npos ||
+                (term.substr(0, eq) != "const" &&
+                 !Classification().field(term.substr(0, eq), &dummy))) {
+                fprintf(stderr, "Invalid score term '%s'\n", term.c_str());
+                return false;
+            }
+            formula->terms_.emplace_back(term.substr(0, eq),
+                                         atof(term.c_str() + eq + 1));
+            start = end + 1;
+        }
+        return true;
+    }
+
+    double score(const Classification& cls) const {
+        double ret = 0;
+        for (const auto& term : terms_) {
+            int value = 1;
+            if (term.first != "const") {
+                cls.field(term.first, &value);
+            }
+            ret += value * term.second;
+        }
+        return ret;
+    }
+
+private:
+    std::vector<std::pair<std::string, double>> terms_;
+};
+
+// A conjunction of comparisons of classification fields (or "score")
+// against numbers, e.g. "dep.depth>=2,all.max_width<=2".
+class PuzzleFilter {
+public:
+    // Returns false, after printing the predicate that isn't one, on an
+    // error. The empty filter accepts everything.
+    static bool parse(const std::string& spec, PuzzleFilter* filter) {
+        filter->predicates_.clear();
+        size_t start = 0;
+        while (start < spec.size()) {
+            size_t end = std::min(spec.find(',', start), spec.size());
+            Predicate predicate;
+            if (!parse_predicate(spec.substr(start, end - start),
+                                 &predicate)) {
+                return false;
+            }
+            filter->predicates_.push_back(predicate);
+            start = end + 1;
+        }
+        return true;
+    }
+
+    // The number of predicates the puzzle satisfies.
+    int matches(const Classification& cls, double score) const {
+        int ret = 0;
+        for (const auto& predicate : predicates_) {
+            if (predicate.matches(cls, score)) {
+                ++ret;
+            }
+        }
+        return ret;
+    }
+
+    bool accepts(const Classification& cls, double score) const {
+        return matches(cls, score) == predicates_.size();
+    }
+
+private:
+    struct Predicate {
+        std::string field;
+        std::string op;
+        double value;
+
+        bool matches(const Classification& cls, double score) const {
+            double actual = score;
+            if (field != "score") {
+                int field_value = 0;
+                cls.field(field, &field_value);
+                actual = field_value;
+            }
+            if (op == ">=") return actual >= value;
+            if (op == "<=") return actual <= value;
+            if (op == "==") return actual == value;
+            if (op == "!=") return actual != value;
+            if (op == ">") return actual > value;
+            return actual < value;
+        }
+    };
+
+    static bool parse_predicate(const std::string& spec, Predicate* ret) {
+        static const char* ops[] = { ">=", "<=", "==", "!=", ">", "<" };
+        for (const char* op : ops) {
+            size_t at = spec.find(op);
+            if (at == std::string::npos) {
+                continue;
+            }
+            *ret = Predicate { spec.substr(0, at), op,
+                               atof(spec.c_str() + at + strlen(op)) };
+            int dummy;
+            if (ret->field != "score" &&
+                !Classification().field(ret->field, &dummy)) {
+                break;
+            }
+            return true;
+        }
+        fprintf(stderr, "Invalid puzzle predicate '%s'\n", spec.c_str());
+        return false;
+    }
+
+    std::vector<Predicate> predicates_;
+};
+
+// A number of puzzles wanted with some property, e.g. "99 puzzles with
+// dep.depth >= 2 and all.max_width <= 2".
+class Quota {
+public:
+    // Parse "count:filter". Returns false, after printing why, on an
+    // error.
+    static bool parse(const std::string& spec, Quota* quota) {
+        size_t colon = spec.find(':');
+        quota->spec_ = spec;
+        quota->target_ = atoi(spec.c_str());
+        quota->filled_ = 0;
+        if (colon == std::string::npos || quota->target_ <= 0) {
+            fprintf(stderr, "Invalid quota '%s'\n", spec.c_str());
+            return false;
+        }
+        return PuzzleFilter::parse(spec.substr(colon + 1), &quota->filter_);
+    }
+
+    bool full() const {
+        return filled_ >= target_;
+    }
+
+    double fill_ratio() const {
+        return double(filled_) / target_;
+    }
+
+    void add(int count = 1) {
+        filled_ += count;
+    }
+
+    int filled() const {
+        return filled_;
+    }
+
+    const PuzzleFilter& filter() const {
+        return filter_;
+    }
+
+    void print_json(FILE* fp) const {
+        fprintf(fp, "{\"quota\": \"%s\", \"target\": %d, "
+                "\"filled\": %d}",
+                spec_.c_str(), target_, filled_);
+    }
+
+private:
+    std::string spec_;
+    int target_ = 0;
+    int filled_ = 0;
+    PuzzleFilter filter_;
+};
+
+#endif // LINJAT_CLASSIFICATION_H
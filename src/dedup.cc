@@ -0,0 +1,250 @@
+#include "dedup.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "puzzledb.h"
+
+using std::string;
+
+string canonical_puzzle(const std::vector<string>& rows) {
+    int height = rows.size();
+    int width = 0;
+    for (const auto& row : rows) {
+        width = std::max(width, int(row.size()));
+    }
+
+    auto cell = [&] (int r, int c) {
+        char ch = c < rows[r].size() ? rows[r][c] : ' ';
+        return (isdigit(ch) || ch == '.') ? ch : ' ';
+    };
+
+    // Each image as a function from its own (r, c) to a cell of the
+    // original puzzle.
+    struct Image {
+        bool transpose, flip_rows, flip_cols;
+    };
+    static const Image images[] = {
+        { false, false, false },
+        { false, false, true },
+        { false, true, false },
+        { false, true, true },
+        { true, false, false },
+        { true, false, true },
+        { true, true, false },
+        { true, true, true },
+    };
+    int image_count = (height == width) ? 8 : 4;
+
+    string best;
+    string image;
+    for (int i = 0; i < image_count; ++i) {
+        image.clear();
+        for (int r = 0; r < height; ++r) {
+            for (int c = 0; c < width; ++c) {
+                int rr = images[i].flip_rows ? height - 1 - r : r;
+                int cc = images[i].flip_cols ? width - 1 - c : c;
+                image.push_back(images[i].transpose ? cell(cc, rr) :
+                                cell(rr, cc));
+            }
+        }
+        if (!i || image < best) {
+            best.swap(image);
+        }
+    }
+
+    char size[32];
+    snprintf(size, sizeof(size), "%dx%d:", height, width);
+    return size + best;
+}
+
+namespace {
+
+uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+}
+
+PuzzleHash canonical_hash(const std::vector<string>& rows) {
+    string canonical = canonical_puzzle(rows);
+    PuzzleHash hash;
+    hash.lo = 0x9e3779b97f4a7c15ULL;
+    hash.hi = 0x6a09e667f3bcc909ULL;
+    for (size_t i = 0; i < canonical.size(); i += 8) {
+        uint64_t word = 0;
+        memcpy(&word, canonical.data() + i,
+               std::min<size_t>(8, canonical.size() - i));
+        hash.lo = mix64(hash.lo ^ word);
+        hash.hi = mix64(hash.hi + word * 0x9fb21c651e98df25ULL);
+    }
+    hash.lo = mix64(hash.lo ^ canonical.size());
+    hash.hi = mix64(hash.hi ^ hash.lo);
+    // All zeros marks an empty slot in PuzzleHashSet.
+    if (hash.empty()) {
+        hash.lo = 1;
+    }
+    return hash;
+}
+
+PuzzleHashSet::PuzzleHashSet() : slots_(1024) {
+}
+
+size_t PuzzleHashSet::slot(PuzzleHash hash) const {
+    size_t mask = slots_.size() - 1;
+    size_t at = hash.lo & mask;
+    while (!slots_[at].empty() && !(slots_[at] == hash)) {
+        at = (at + 1) & mask;
+    }
+    return at;
+}
+
+bool PuzzleHashSet::contains(PuzzleHash hash) const {
+    return !slots_[slot(hash)].empty();
+}
+
+bool PuzzleHashSet::insert(PuzzleHash hash) {
+    size_t at = slot(hash);
+    if (!slots_[at].empty()) {
+        return false;
+    }
+    slots_[at] = hash;
+    // Keep the load factor under 3/4, so that probe sequences stay
+    // short.
+    if (++size_ * 4 > slots_.size() * 3) {
+        grow();
+    }
+    return true;
+}
+
+void PuzzleHashSet::grow() {
+    std::vector<PuzzleHash> old(slots_.size() * 2);
+    old.swap(slots_);
+    for (const auto& hash : old) {
+        if (!hash.empty()) {
+            slots_[slot(hash)] = hash;
+        }
+    }
+}
+
+int64_t load_puzzle_hashes(const string& pattern, PuzzleHashSet* set) {
+    PuzzleReader reader(pattern);
+    PuzzleRecord record;
+    int64_t count = 0;
+    while (reader.next(&record)) {
+        set->insert(canonical_hash(record.puzzle));
+        ++count;
+    }
+    return count;
+}
+
+int dedup_puzzledb(const string& pattern) {
+    PuzzleHashSet seen;
+    PuzzleRecord record;
+    char* line = nullptr;
+    size_t line_size = 0;
+    int64_t total = 0, total_dropped = 0;
+
+    PuzzleReader reader(pattern);
+    for (const auto& file : reader.files()) {
+        FILE* in = fopen(file.c_str(), "r");
+        if (!in) {
+            perror(file.c_str());
+            free(line);
+            return 1;
+        }
+        string tmp = file + ".tmp";
+        FILE* out = fopen(tmp.c_str(), "w");
+        if (!out) {
+            perror(tmp.c_str());
+            fclose(in);
+            free(line);
+            return 1;
+        }
+
+        int64_t dropped = 0;
+        while (getline(&line, &line_size, in) >= 0) {
+            if (parse_puzzle_record(line, &record)) {
+                ++total;
+                if (!seen.insert(canonical_hash(record.puzzle))) {
+                    ++dropped;
+                    continue;
+                }
+            }
+            fputs(line, out);
+        }
+        fclose(in);
+        if (fclose(out) != 0) {
+            perror(tmp.c_str());
+            free(line);
+            return 1;
+        }
+
+        if (dropped) {
+            fprintf(stderr, "%s: dropped %ld duplicates\n", file.c_str(),
+                    dropped);
+            if (rename(tmp.c_str(), file.c_str()) != 0) {
+                perror(file.c_str());
+                free(line);
+                return 1;
+            }
+        } else {
+            remove(tmp.c_str());
+        }
+        total_dropped += dropped;
+    }
+    free(line);
+
+    fprintf(stderr, "%ld puzzles, %ld duplicates, %ld unique\n",
+            total, total_dropped, total - total_dropped);
+    return 0;
+}
+
+int merge_shards(const string& pattern, bool dedup, FILE* out) {
+    std::vector<std::pair<int64_t, string>> records;
+    PuzzleReader reader(pattern);
+    PuzzleRecord record;
+    while (reader.next(&record)) {
+        string index;
+        if (!json_object_value(record.json, "index", &index)) {
+            fprintf(stderr, "%s: record without an index, not from "
+                    "--shard\n", reader.file().c_str());
+            return 1;
+        }
+        records.emplace_back(atoll(index.c_str()), record.json);
+    }
+    std::stable_sort(records.begin(), records.end(),
+                     [] (const std::pair<int64_t, string>& a,
+                         const std::pair<int64_t, string>& b) {
+                         return a.first < b.first;
+                     });
+
+    PuzzleHashSet seen;
+    int64_t repeated = 0, duplicates = 0, merged = 0;
+    for (int i = 0; i < records.size(); ++i) {
+        // The same index from overlapping or rerun shards.
+        if (i && records[i].first == records[i - 1].first) {
+            ++repeated;
+            continue;
+        }
+        parse_puzzle_record(records[i].second, &record);
+        if (dedup && !seen.insert(canonical_hash(record.puzzle))) {
+            ++duplicates;
+            continue;
+        }
+        fprintf(out, "%s\n", records[i].second.c_str());
+        ++merged;
+    }
+
+    fprintf(stderr, "%zu records, %ld repeated indices, %ld duplicates, "
+            "%ld merged\n", records.size(), repeated, duplicates, merged);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef LINJAT_DEDUP_H
+#define LINJAT_DEDUP_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Puzzles that are mirror images or rotations of each other are the
+// same puzzle as far as a player is concerned. The canonical form of a
+// puzzle is the lexicographically smallest of its images under the
+// board's symmetries: horizontal and vertical mirroring and 180 degree
+// rotation, plus transposition for square boards. Only hints and dots
+// count; the classification doesn't.
+std::string canonical_puzzle(const std::vector<std::string>& rows);
+
+// 128-bit hash of the canonical form. Never all zeros.
+struct PuzzleHash {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool empty() const {
+        return !lo && !hi;
+    }
+    bool operator==(const PuzzleHash& other) const {
+        return lo == other.lo && hi == other.hi;
+    }
+};
+
+PuzzleHash canonical_hash(const std::vector<std::string>& rows);
+
+// Open addressing hash set of puzzle hashes, at 16 bytes per slot.
+class PuzzleHashSet {
+public:
+    PuzzleHashSet();
+
+    // Returns false if the hash was already in the set.
+    bool insert(PuzzleHash hash);
+    bool contains(PuzzleHash hash) const;
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    size_t slot(PuzzleHash hash) const;
+    void grow();
+
+    std::vector<PuzzleHash> slots_;
+    size_t size_ = 0;
+};
+
+// Add all puzzles in the files matching the glob pattern to the set.
+// Returns the number of puzzles read.
+int64_t load_puzzle_hashes(const std::string& pattern, PuzzleHashSet* set);
+
+// Remove duplicate puzzles from the files matching the glob pattern,
+// keeping the first copy in file name order. Files are only rewritten
+// if they had duplicates. Returns 0 on success.
+int dedup_puzzledb(const std::string& pattern);
+
+// Write the records of the --shard outputs matching the glob pattern to
+// out in index order, keeping the first copy of each puzzle if dedup is
+// set. The result only depends on the indices covered, not on how they
+// were split into shards. Returns 0 on success.
+int merge_shards(const std::string& pattern, bool dedup, FILE* out);
+
+#endif // LINJAT_DEDUP_H
@@ -0,0 +1,1813 @@
+#ifndef LINJAT_GAME_H
+#define LINJAT_GAME_H
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "perf.h"
+#include "rng.h"
+enum DeductionKind {
+    NONE = 0,
+    COVER = 1,
+    CANT_FIT = 2,
+    SQUARE = 3,
+    DEPENDENCY = 4,
+    ONE_OF = 5,
+    SINGLE_SOLUTION = 6,
+    UNCONTESTED_NO_COVER = 7,
+};
+
+// The deduction rules that Game::iterate() can be limited to a subset
+// of, as a bitmask. The others are always used.
+enum Rule : unsigned {
+    RULE_SQUARE = 1 << 0,
+    RULE_DEPENDENCY = 1 << 1,
+    RULE_ONE_OF = 1 << 2,
+    ALL_RULES = RULE_SQUARE | RULE_DEPENDENCY | RULE_ONE_OF,
+};
+
+// The ways that Game::mutate() can change a puzzle. The first three
+// change one hint; swap exchanges the sizes of two hints, nudge moves a
+// hint to a neighboring square, and move-dot moves one dot.
+enum MutationOp {
+    MUTATE_SHRINK,
+    MUTATE_GROW,
+    MUTATE_RELOCATE,
+    MUTATE_SWAP,
+    MUTATE_NUDGE,
+    MUTATE_MOVE_DOT,
+    MUTATION_OP_COUNT,
+};
+
+// A board of MapHeight x MapWidth squares with Pieces hints, and the
+// solver's knowledge of it. The size is a template parameter so that
+// the per-square arrays have fixed sizes; see board_sizes.h for the
+// sizes that the library is built with.
+template <int MapHeight, int MapWidth, int Pieces>
+class Game {
+public:
+    static const int W = MapWidth + 1, H = MapHeight, N = Pieces;
+
+    // Use the narrowest types that fit the board size, since the
+    // optimizer copies Games around constantly.
+    using Square =
+        typename std::conditional<(H * W <= 256), uint8_t, uint16_t>::type;
+    using Hint = std::pair<Square, uint8_t>;
+    using Mask = typename std::conditional<
+        (N <= 8), uint8_t, typename std::conditional<
+            (N <= 16), uint16_t, typename std::conditional<
+                (N <= 32), uint32_t, uint64_t>::type>::type>::type;
+    using MaskArray = std::array<Mask, H * W>;
+    using DepMask = std::bitset<H * W>;
+    using SquareSet = std::bitset<H * W>;
+    // Piece index + 1 of the piece covering each square, or 0 if no
+    // piece has been fixed on it yet.
+    using PieceArray = std::array<uint8_t, H * W>;
+    using CountArray = std::array<uint8_t, H * W>;
+    static_assert(N <= 64, "Pieces must fit in a 64 bit mask");
+
+    using IterationResult = std::pair<DeductionKind, int>;
+
+    // An undo log of the solver state. While a trail is attached to a
+    // Game, every change to the hints, hint_orientation_, fixed_,
+    // valid_orientation_, possible_ and forced_ records the overwritten
+    // value, so that speculative work can be undone with rollback()
+    // instead of being done on a copy of the whole Game. A rollback
+    // shouldn't go back to between mutate() and finish_mutation().
+    //
+    // possible_ is rebuilt from scratch on every iterate(), so logging
+    // it square by square would cost more than it saves. Instead the
+    // whole array is saved on the first change after each checkpoint.
+    class Trail {
+    public:
+        using Checkpoint = size_t;
+
+        Checkpoint checkpoint() {
+            possible_saved_ = false;
+            return entries_.size();
+        }
+
+        void clear() {
+            entries_.clear();
+            possible_.clear();
+            possible_saved_ = false;
+        }
+
+    private:
+        friend class Game;
+
+        enum Kind : uint8_t {
+            HINT, HINT_ORIENTATION, FIXED, ORIENTATION, POSSIBLE, FORCED
+        };
+
+        struct Entry {
+            Kind kind;
+            uint16_t index;
+            uint64_t value;
+        };
+
+        void push(Kind kind, int index, uint64_t value) {
+            entries_.push_back(Entry { kind, uint16_t(index), value });
+        }
+
+        void save_possible(const MaskArray& possible) {
+            push(POSSIBLE, 0, possible_.size());
+            possible_.push_back(possible);
+            possible_saved_ = true;
+        }
+
+        std::vector<Entry> entries_;
+        std::vector<MaskArray> possible_;
+        bool possible_saved_ = false;
+    };
+
+    // Whether a puzzle in the format of --solve can be loaded: the size
+    // of this board, with a border in the first column and nowhere
+    // else, N hints of at least 1, and otherwise only dots and spaces.
+    static bool valid_map(std::string_view map) {
+        if (map.size() != W * H) {
+            return false;
+        }
+        int hints = 0;
+        for (int at = 0; at < W * H; ++at) {
+            char c = map[at];
+            if (border(at) != (c == ',')) {
+                return false;
+            }
+            if (isdigit(c)) {
+                if (c == '0') {
+                    return false;
+                }
+                ++hints;
+            } else if (c != ',' && c != '.' && c != ' ') {
+                return false;
+            }
+        }
+        return hints == N;
+    }
+
+    // The puzzle must be a valid_map(), or empty for random hints.
+    Game(std::string_view puzzle = "") {
+        if (!puzzle.empty()) {
+            setup_map(puzzle);
+        } else {
+            randomize();
+        }
+        init_hints();
+        reset_possible();
+        update_possible();
+    }
+
+    // Selects the constructor for a puzzle with no dots yet, and with
+    // the hints of a random layout of pieces that don't overlap, so
+    // that it has at least that solution.
+    struct Layout {
+    };
+
+    explicit Game(Layout) {
+        construct();
+        init_hints();
+        reset_possible();
+        update_possible();
+    }
+
+    void randomize() {
+        for (int i = 0; i < N; ++i) {
+            while (1) {
+                int at = rng() % (W * H);
+                int val = 2 + rng() % 4;
+                if (!fixed_[at] && !border(at)) {
+                    set_hint(i, Hint(at, val));
+                    set_fixed(at, piece_id(i));
+                    break;
+                }
+            }
+        }
+    }
+
+    void construct() {
+        std::array<Hint, N> hints;
+        SquareSet covered;
+        int placed = 0;
+        // Place the pieces one at a time where they fit, and start over
+        // if the board fills up before they're all in.
+        for (int tries = 0; placed < N; ++tries) {
+            if (tries == 100 * N) {
+                covered.reset();
+                placed = tries = 0;
+            }
+            int at = rng() % (W * H);
+            int val = 2 + rng() % 4;
+            int o = rng() % (val * 2);
+            if (border(at) || covered[at]) {
+                continue;
+            }
+            SquareSet squares;
+            for (int sq : PieceOrientationIterator(Hint(at, val), o)) {
+                if (border(sq) || covered[sq]) {
+                    break;
+                }
+                squares[sq] = true;
+            }
+            if (squares.count() != val) {
+                continue;
+            }
+            covered |= squares;
+            hints[placed++] = Hint(at, val);
+        }
+        for (int i = 0; i < N; ++i) {
+            set_hint(i, hints[i]);
+            set_fixed(hints[i].first, piece_id(i));
+        }
+    }
+
+    void setup_map(std::string_view map) {
+        assert(map.size() == W * H);
+
+        int pieces = 0;
+        for (int i = 0; i < H * W; ++i) {
+            if (map[i] == ',') {
+                assert(border(i));
+            } else if (map[i] == '.') {
+                set_forced(i, true);
+            } else if (isdigit(map[i])) {
+                int val = map[i] - '0';
+                set_hint(pieces, Hint(i, val));
+                set_fixed(i, piece_id(pieces++));
+            }
+        }
+
+        assert(pieces == N);
+    }
+
+    // Forget all deductions, going back to just the hints.
+    void reset_hints() {
+        reset_fixed();
+        for (int i = 0; i < N; ++i) {
+            set_valid_orientation(i, hint_orientation_[i]);
+        }
+    }
+
+    // reset_hints() for new hints, working out which orientations of
+    // each piece fit between them.
+    void init_hints() {
+        reset_fixed();
+        for (int i = 0; i < N; ++i) {
+            set_hint_orientation(i, init_valid_orientations(i, fixed_));
+            set_valid_orientation(i, hint_orientation_[i]);
+        }
+    }
+
+    // Start recording changes in trail, or stop recording if it is
+    // null. Copying or assigning a Game never carries the trail along.
+    void set_trail(Trail* trail) {
+        trail_.trail = trail;
+    }
+
+    typename Trail::Checkpoint checkpoint() {
+        return trail_.trail->checkpoint();
+    }
+
+    // Undo all changes recorded in the trail since checkpoint.
+    void rollback(typename Trail::Checkpoint checkpoint) {
+        Trail* trail = trail_.trail;
+        auto& entries = trail->entries_;
+        trail->possible_saved_ = false;
+        while (entries.size() > checkpoint) {
+            const auto& e = entries.back();
+            switch (e.kind) {
+            case Trail::HINT:
+                hints_[e.index] = Hint(e.value >> 8, e.value & 0xff);
+                break;
+            case Trail::HINT_ORIENTATION:
+                hint_orientation_[e.index] = e.value;
+                break;
+            case Trail::FIXED:
+                fixed_[e.index] = e.value;
+                break;
+            case Trail::ORIENTATION:
+                valid_orientation_[e.index] = e.value;
+                break;
+            case Trail::POSSIBLE:
+                possible_ = trail->possible_.back();
+                trail->possible_.pop_back();
+                break;
+            case Trail::FORCED:
+                forced_[e.index] = e.value;
+                break;
+            }
+            entries.pop_back();
+        }
+    }
+
+    // The puzzle as rows of hints, dots and spaces, without the border.
+    std::vector<std::string> puzzle_rows() const {
+        std::map<int, int> hints;
+        for (auto hint : hints_) {
+            hints[hint.first] = hint.second;
+        }
+
+        std::vector<std::string> rows;
+        int at = 0;
+        for (int r = 0; r < H; ++r) {
+            std::string row;
+            for (int c = 0; c < W; ++c) {
+                if (!border(at)) {
+                    if (hints.count(at)) {
+                        row += std::to_string(hints[at]);
+                    } else if (forced_[at]) {
+                        row += '.';
+                    } else {
+                        row += ' ';
+                    }
+                }
+                ++at;
+            }
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+    // The hints in piece order and the dots, packed into a string. Two
+    // games have the same key exactly when they're the same puzzle
+    // with the pieces numbered the same way, so everything derived
+    // from the puzzle alone can be looked up by it.
+    std::string puzzle_key() const {
+        std::string key;
+        key.reserve(3 * N + (W * H + 7) / 8);
+        for (auto hint : hints_) {
+            key += char(hint.first & 0xff);
+            key += char(hint.first >> 8);
+            key += char(hint.second);
+        }
+        for (int at = 0; at < W * H; at += 8) {
+            char bits = 0;
+            for (int i = 0; i < 8 && at + i < W * H; ++i) {
+                bits |= forced_[at + i] << i;
+            }
+            key += bits;
+        }
+        return key;
+    }
+
+    void print_puzzle(bool json, FILE* fp = stdout) const {
+        std::vector<std::string> rows = puzzle_rows();
+        for (int r = 0; r < H; ++r) {
+            if (json) {
+                fprintf(fp, "\"%s\"", rows[r].c_str());
+                if (r != H - 1) {
+                    fprintf(fp, ", ");
+                }
+            } else {
+                fprintf(fp, "%s\n", rows[r].c_str());
+            }
+        }
+    }
+
+    // The complete solver state as a list of numbers, for checkpoints.
+    std::string save() const {
+        std::string ret;
+        auto add = [&ret] (uint64_t value) {
+            ret += std::to_string(value) + " ";
+        };
+        for (int piece = 0; piece < N; ++piece) {
+            add(hints_[piece].first);
+            add(hints_[piece].second);
+            add(valid_orientation_[piece]);
+        }
+        for (int at = 0; at < W * H; ++at) {
+            add(possible_[at]);
+            add(fixed_[at]);
+            add(forced_[at]);
+        }
+        return ret;
+    }
+
+    bool restore(const std::string& saved) {
+        const char* p = saved.c_str();
+        bool ok = true;
+        auto next = [&p, &ok] () {
+            char* end;
+            uint64_t value = strtoull(p, &end, 10);
+            ok = ok && end != p;
+            p = end;
+            return value;
+        };
+        for (int piece = 0; piece < N; ++piece) {
+            hints_[piece].first = next();
+            hints_[piece].second = next();
+            valid_orientation_[piece] = next();
+        }
+        for (int at = 0; at < W * H; ++at) {
+            possible_[at] = next();
+            fixed_[at] = next();
+            forced_[at] = next();
+        }
+        // fixed_ has the deductions too, so find the orientations that
+        // fit between the hints from the hints alone.
+        PieceArray hint_ids = { 0 };
+        for (int piece = 0; piece < N; ++piece) {
+            hint_ids[hints_[piece].first] = piece_id(piece);
+        }
+        for (int piece = 0; piece < N; ++piece) {
+            hint_orientation_[piece] = init_valid_orientations(piece,
+                                                               hint_ids);
+        }
+        mutated_ = 0;
+        moved_count_ = 0;
+        return ok;
+    }
+
+    void print_fixed() {
+        int at = 0;
+        for (int r = 0; r < H; ++r) {
+            for (int c = 0; c < W; ++c) {
+                if (!border(at)) {
+                    if (fixed_[at]) {
+                        fprintf(stderr,
+                                "%d",
+                                hints_[fixed_to_piece(fixed_[at])].second);;
+                    } else if (forced_[at]) {
+                        fprintf(stderr, ".");
+                    } else if (!possible_[at]) {
+                        fprintf(stderr, "_");
+                    } else {
+                        fprintf(stderr, " ");
+                    }
+                }
+                ++at;
+            }
+            fprintf(stderr, "|\n");
+        }
+        fprintf(stderr, "\n");
+    }
+
+    void print_possible() {
+        int at = 0;
+        for (int r = 0; r < H; ++r) {
+            for (int c = 0; c < W; ++c) {
+                // if (!border(at)) {
+                //     printf("%d ",
+                //            fixed_[at] ?
+                //            hints_[fixed_to_piece(fixed_[at])].second :
+                //            0);
+                // }
+                if (!border(at)) {
+                    if (false) {
+                        printf("[%d %d] ",
+                               possible_count(at),
+                               orig_possible_counts()[at] -
+                               possible_count(at));
+                    } else if (possible_count(at)) {
+                        printf("% 2d%c%d ",
+                               possible_count(at),
+                               forced_[at] ? 'X' : '?',
+                               fixed_[at] ?
+                               hints_[fixed_to_piece(fixed_[at])].second :
+                               0);
+                    } else {
+                        bool printed = false;
+                        for (int p = 0; p < N; ++p) {
+                            if (hints_[p].first == at) {
+                                printf(" % 3d ",
+                                       // valid_orientation_[p]);
+                                       orientation_count(p));
+                                printed = true;
+                            }
+                        }
+                        if (!printed)
+                            printf("  .  ");
+                    }
+                }
+                ++at;
+            }
+            printf("\n");
+        }
+    }
+
+    void print_json(FILE* f, const char* extra_json) {
+        fprintf(f, "{%s\"height\":%d, \"width\":%d, \"lines\":[\n",
+                extra_json, H, W -1);
+        for (int piece = 0; piece < N; ++piece) {
+            int at = hints_[piece].first;
+            int value = hints_[piece].second;
+            int r = at / W, c = at % W;
+            int minr = r, maxr = r, minc = c, maxc = c;
+            for (int at = 0; at < W * H; ++at) {
+                if (fixed_[at] == piece_id(piece)) {
+                    minr = std::min(minr, at / W);
+                    maxr = std::max(maxr, at / W);
+                    minc = std::min(minc, at % W);
+                    maxc = std::max(maxc, at % W);
+                }
+            }
+
+            int valid_o = valid_orientation_[piece];
+            bool have_vertical = false, have_horizontal = false;
+            for (int o = 0; o < value * 2; ++o) {
+                if (valid_o & (1 << o)) {
+                    if (o & 1) {
+                        have_vertical = true;
+                    } else {
+                        have_horizontal = true;
+                    }
+                }
+            }
+
+            fprintf(f,
+                    "{\"r\":%d,\"c\":%d,\"value\":\"%d\",",
+                    r, c - 1, value);
+            if (have_vertical != have_horizontal) {
+                fprintf(f,
+                        "\"hz\":%d,"
+                        "\"minr\":%d,\"minc\":%d,\"maxr\":%d,\"maxc\":%d,\n",
+                        have_horizontal,
+                        minr, minc - 1,
+                        maxr, maxc - 1);
+            }
+            fprintf(f,
+                    "},\n");
+        }
+        fprintf(f, "],\"dots\":[\n");
+        for (int at = 0; at < W * H; ++at) {
+            if (forced_[at]) {
+                fprintf(f,
+                        "{\"r\":%d,\"c\":%d},\n", at / W, at % W - 1);
+            }
+        }
+        fprintf(f, "],\n");
+        fprintf(f, "},\n");
+    }
+
+    void reset_possible() {
+        for (int at = 0; at < W * H; ++at) {
+            set_possible(at, 0);
+        }
+    }
+
+    // Make the first deduction that the rules allow. The rules are a
+    // template parameter, so that the ones left out cost nothing.
+    template <unsigned Rules = ALL_RULES>
+    IterationResult iterate() {
+        reset_possible();
+
+        {
+            update_possible();
+            int count;
+
+            count = update_uncontested_no_cover();
+            if (count) {
+                return { DeductionKind::UNCONTESTED_NO_COVER, count };
+            }
+
+            count = update_forced_coverage();
+            if (count) {
+                return { DeductionKind::COVER, count };
+            }
+
+            // Put this after forced_coverage, since it's not interesting
+            // if abusing knowledge of a single solution gives just the
+            // same deduction as the trivial rule.
+            count = update_knowledge_of_single_solution();
+            if (count) {
+                update_forced_coverage();
+                return { DeductionKind::SINGLE_SOLUTION, count };
+            }
+
+            count = update_cant_fit();
+            if (count) {
+                return { DeductionKind::CANT_FIT, count };
+            }
+        }
+
+
+        if constexpr ((Rules & RULE_SQUARE) != 0) {
+            update_square();
+            // Is there really no need to check u_forced_coverage
+            // here?
+            int count = update_cant_fit();
+            if (count) {
+                return { DeductionKind::SQUARE, count };
+            }
+        }
+
+        if constexpr ((Rules & RULE_DEPENDENCY) != 0) {
+            update_dependent();
+            int count = update_cant_fit();
+            if (count) {
+                return { DeductionKind::DEPENDENCY, count };
+            }
+        }
+
+        if constexpr ((Rules & RULE_ONE_OF) != 0) {
+            update_one_of();
+            int count = update_cant_fit();
+            if (count) {
+                return { DeductionKind::ONE_OF, count };
+            }
+        }
+
+        return { DeductionKind::NONE, 0 };
+    }
+
+    // iterate() with the rules picked at run time.
+    IterationResult iterate(unsigned rules) {
+        switch (rules & ALL_RULES) {
+        case 0:
+            return iterate<0>();
+        case 1:
+            return iterate<1>();
+        case 2:
+            return iterate<2>();
+        case 3:
+            return iterate<3>();
+        case 4:
+            return iterate<4>();
+        case 5:
+            return iterate<5>();
+        case 6:
+            return iterate<6>();
+        default:
+            return iterate<ALL_RULES>();
+        }
+    }
+
+    int update_cant_fit() {
+        PerfScope perf(PERF_CANT_FIT);
+        int count = 0;
+        for (int piece = 0; piece < N; ++piece) {
+            count += update_cant_fit_for_piece(piece);
+        }
+        return count;
+    }
+
+    int update_forced_coverage() {
+        PerfScope perf(PERF_COVER);
+        int count = 0;
+        for (int piece = 0; piece < N; ++piece) {
+            count += update_forced_coverage_for_piece(piece);
+        }
+        return count;
+    }
+
+    void reset_forced() {
+        for (int at = 0; at < W * H; ++at) {
+            set_forced(at, false);
+        }
+    }
+
+    // For each square, the number of pieces that could cover it given
+    // just the hints. Only needed while placing dots, so this is computed
+    // on demand from the orientations that fit between the hints, rather
+    // than carried around in every copy of the Game.
+    CountArray orig_possible_counts() const {
+        MaskArray orig_possible = { 0 };
+        for (int piece = 0; piece < N; ++piece) {
+            int valid_o = hint_orientation_[piece];
+            for (int o = 0; valid_o >> o; ++o) {
+                if (!(valid_o & (1 << o))) {
+                    continue;
+                }
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    orig_possible[at] |= piece_mask(piece);
+                }
+            }
+        }
+
+        CountArray ret;
+        for (int at = 0; at < W * H; ++at) {
+            ret[at] = __builtin_popcountl(orig_possible[at]);
+        }
+        return ret;
+    }
+
+    bool force_one_square(const CountArray& orig_possible_count,
+                          Mask possible_mask = ~Mask(0)) {
+        int best_at = -1;
+        int best_score = -1;
+        int best_score_count;
+
+        for (int at = 0; at < W *H; ++at) {
+            if (fixed_[at] || forced_[at] ||
+                !(possible_[at] & possible_mask)) {
+                continue;
+            }
+            int score = orig_possible_count[at] + possible_count(at);
+            if (score > best_score) {
+                best_score = score;
+                best_at = at;
+                best_score_count = 1;
+            } else if (best_score == score) {
+                ++best_score_count;
+                if (rng() % best_score_count == 0) {
+                    best_at = at;
+                }
+            }
+        }
+
+        if (best_at >= 0) {
+            set_forced(best_at, true);
+            return true;
+        }
+        return false;
+    }
+
+    bool force_if_uncontested(const CountArray& orig_possible_count) {
+        reset_possible();
+        update_possible();
+        bool ret = false;
+        for (int piece = 0; piece < N; ++piece) {
+            if (!find_uncontested_no_cover(piece))
+                continue;
+            assert(force_one_square(orig_possible_count, piece_mask(piece)));
+            ret = true;
+        }
+
+        return ret;
+    }
+
+    bool impossible() {
+        for (int piece = 0; piece < N; ++piece) {
+            if (!valid_orientation_[piece])
+                return true;
+        }
+
+        for (int at = 0; at < W *H; ++at) {
+            if (forced_[at] && !possible_[at]) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool solved() {
+        for (int piece = 0; piece < N; ++piece) {
+            if (orientation_count(piece) != 1) {
+                return false;
+            }
+        }
+
+        for (int at = 0; at < W *H; ++at) {
+            if (forced_[at] && !fixed_[at]) {
+                return false;
+            }
+        }
+
+        // The deductions can leave a piece with a single orientation
+        // that runs into squares already taken by another piece.
+        // That's a contradiction, not a solution.
+        if (!consistent()) {
+            return false;
+        }
+
+        validate();
+
+        return true;
+    }
+
+    bool consistent() {
+        SquareSet claimed;
+        for (int piece = 0; piece < N; ++piece) {
+            for (int at : PieceOrientationIterator(
+                     hints_[piece],
+                     __builtin_ctzl(valid_orientation_[piece]))) {
+                if ((fixed_[at] && fixed_[at] != piece_id(piece)) ||
+                    claimed[at]) {
+                    return false;
+                }
+                claimed[at] = true;
+            }
+        }
+        return true;
+    }
+
+    void validate() {
+        std::array<int, N> count { 0 };
+        for (int piece = 0; piece < N; ++piece) {
+            assert(orientation_count(piece) == 1);
+            for (int at : PieceOrientationIterator(
+                     hints_[piece],
+                     __builtin_ctzl(valid_orientation_[piece]))) {
+                if (fixed_[at]) {
+                    assert(fixed_[at] == piece_id(piece));
+                } else {
+                    set_fixed(at, piece_id(piece));
+                }
+            }
+        }
+
+        for (int at = 0; at < W * H; ++at) {
+            if (forced_[at]) {
+                assert(fixed_[at]);
+            }
+            if (fixed_[at]) {
+                count[fixed_to_piece(fixed_[at])]++;
+            }
+        }
+
+        for (int piece = 0; piece < N; ++piece) {
+            assert(count[piece] == hints_[piece].second);
+        }
+    }
+
+    // Apply one mutation operator, to the given piece's hint for the
+    // hint operators. Returns false if the operator didn't apply, in
+    // which case nothing was changed. Call finish_mutation() after the
+    // last one.
+    bool mutate(MutationOp op, int piece) {
+        int at = hints_[piece].first;
+        int size = hints_[piece].second;
+
+        switch (op) {
+        case MUTATE_SHRINK:
+            if (size > 1) {
+                set_hint(piece, Hint(at, size - 1));
+                mutated_ |= piece_mask(piece);
+                return true;
+            }
+            return false;
+        case MUTATE_GROW:
+            if (size < 8) {
+                set_hint(piece, Hint(at, size + 1));
+                mutated_ |= piece_mask(piece);
+                return true;
+            }
+            return false;
+        case MUTATE_RELOCATE:
+            set_fixed(at, 0);
+            hint_moved(piece, at);
+            while (1) {
+                int at = rng() % (W * H);
+                if (!fixed_[at] && !border(at)) {
+                    set_hint(piece, Hint(at, size));
+                    set_fixed(at, piece_id(piece));
+                    set_forced(at, false);
+                    hint_moved(piece, at);
+                    break;
+                }
+            }
+            return true;
+        case MUTATE_SWAP: {
+            // Exchange the sizes of two hints.
+            int other = rng() % N;
+            int other_size = hints_[other].second;
+            if (other_size == size) {
+                return false;
+            }
+            set_hint(piece, Hint(at, other_size));
+            set_hint(other, Hint(hints_[other].first, size));
+            mutated_ |= piece_mask(piece) | piece_mask(other);
+            return true;
+        }
+        case MUTATE_NUDGE: {
+            static const int deltas[] = { -1, 1, -W, W };
+            int to = at + deltas[rng() % 4];
+            if (to < 0 || to >= W * H || border(to) || hint_at(to)) {
+                return false;
+            }
+            set_fixed(at, 0);
+            set_hint(piece, Hint(to, size));
+            set_fixed(to, piece_id(piece));
+            set_forced(to, false);
+            hint_moved(piece, at);
+            hint_moved(piece, to);
+            return true;
+        }
+        case MUTATE_MOVE_DOT: {
+            // Move the n'th dot to a random empty square.
+            int dots = 0;
+            for (int at = 0; at < W * H; ++at) {
+                dots += forced_[at];
+            }
+            if (!dots) {
+                return false;
+            }
+            int n = rng() % dots;
+            int from = 0;
+            while (!forced_[from] || n--) {
+                ++from;
+            }
+            while (1) {
+                int to = rng() % (W * H);
+                if (!border(to) && !forced_[to] && !hint_at(to)) {
+                    set_forced(from, false);
+                    set_forced(to, true);
+                    return true;
+                }
+            }
+        }
+        default:
+            return false;
+        }
+    }
+
+    // Go back to just the hints after mutate(). Only the pieces that
+    // the mutations changed, and those that could reach a square that a
+    // hint moved from or to, can have different orientations fitting
+    // between the hints, so only those are worked out again.
+    void finish_mutation() {
+        reset_fixed();
+        for (int piece = 0; piece < N; ++piece) {
+            Hint hint = hints_[piece];
+            bool affected = mutated_ & piece_mask(piece);
+            for (int i = 0; !affected && i < moved_count_; ++i) {
+                affected = distance(hint.first, moved_[i]) < hint.second;
+            }
+            if (affected) {
+                set_hint_orientation(piece,
+                                     init_valid_orientations(piece, fixed_));
+            }
+            set_valid_orientation(piece, hint_orientation_[piece]);
+        }
+        mutated_ = 0;
+        moved_count_ = 0;
+        reset_possible();
+        update_possible();
+    }
+
+    // The piece covering a square, or -1, and the orientations still
+    // possible for a piece. For comparing with ReferenceGame.
+    int fixed_piece(int at) const {
+        return fixed_[at] ? fixed_to_piece(fixed_[at]) : -1;
+    }
+
+    uint16_t valid_orientations(int piece) const {
+        return valid_orientation_[piece];
+    }
+
+    // The squares a piece covers in one orientation.
+    SquareSet orientation_squares(int piece, int o) const {
+        SquareSet ret;
+        for (int at : PieceOrientationIterator(hints_[piece], o)) {
+            ret[at] = true;
+        }
+        return ret;
+    }
+
+    bool dot(int at) const {
+        return forced_[at];
+    }
+
+    // The piece whose hint is on a square, or -1.
+    int hint_piece(int at) const {
+        for (int piece = 0; piece < N; ++piece) {
+            if (hints_[piece].first == at) {
+                return piece;
+            }
+        }
+        return -1;
+    }
+
+    // Seed the solver with a line the player has drawn for a piece,
+    // covering the squares from from to to on one row or column: fix
+    // those squares, and keep only the orientations that cover all of
+    // them. Returns false, leaving the Game in an unknown state, if no
+    // orientation does or a square is taken by another piece.
+    bool apply_line(int piece, int from, int to) {
+        if (from > to) {
+            std::swap(from, to);
+        }
+        int step = (to - from) % W == 0 ? W : 1;
+        if (from == to) {
+            step = 1;
+        } else if (step == 1 && from / W != to / W) {
+            return false;
+        }
+
+        SquareSet line;
+        int length = 0;
+        for (int at = from; at <= to; at += step) {
+            if (border(at) ||
+                (fixed_[at] && fixed_[at] != piece_id(piece))) {
+                return false;
+            }
+            line[at] = true;
+            ++length;
+        }
+
+        int size = hints_[piece].second;
+        uint16_t valid_o = 0;
+        for (int o = 0; o < size * 2; ++o) {
+            if (!(valid_orientation_[piece] & (1 << o))) {
+                continue;
+            }
+            int covered = 0;
+            for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                covered += line[at];
+            }
+            if (covered == length) {
+                valid_o |= 1 << o;
+            }
+        }
+        if (!valid_o) {
+            return false;
+        }
+
+        set_valid_orientation(piece, valid_o);
+        for (int at = from; at <= to; at += step) {
+            set_fixed(at, piece_id(piece));
+        }
+        return true;
+    }
+
+private:
+    static bool border(int at) {
+        return at % W == 0;
+    }
+
+    // Clear all the squares fixed by deductions, leaving the hints.
+    void reset_fixed() {
+        for (int at = 0; at < W * H; ++at) {
+            set_fixed(at, 0);
+        }
+        for (int i = 0; i < N; ++i) {
+            set_fixed(hints_[i].first, piece_id(i));
+        }
+    }
+
+    // Note for finish_mutation() that the hint of piece moved from or
+    // to a square. If too many have moved to keep track of, every
+    // piece is worked out again.
+    void hint_moved(int piece, int at) {
+        mutated_ |= piece_mask(piece);
+        if (moved_count_ == moved_.size()) {
+            mutated_ = ~Mask(0);
+            return;
+        }
+        moved_[moved_count_++] = at;
+    }
+
+    bool hint_at(int at) const {
+        for (int piece = 0; piece < N; ++piece) {
+            if (hints_[piece].first == at) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // All changes to the solver state go through these, so that they
+    // can be recorded in the trail.
+    void set_hint(int piece, Hint hint) {
+        if (trail_.trail) {
+            const Hint& old = hints_[piece];
+            trail_.trail->push(Trail::HINT, piece,
+                               (old.first << 8) | old.second);
+        }
+        hints_[piece] = hint;
+    }
+
+    void set_fixed(int at, uint8_t id) {
+        if (trail_.trail && fixed_[at] != id) {
+            trail_.trail->push(Trail::FIXED, at, fixed_[at]);
+        }
+        fixed_[at] = id;
+    }
+
+    void set_hint_orientation(int piece, uint16_t valid_o) {
+        if (trail_.trail && hint_orientation_[piece] != valid_o) {
+            trail_.trail->push(Trail::HINT_ORIENTATION, piece,
+                               hint_orientation_[piece]);
+        }
+        hint_orientation_[piece] = valid_o;
+    }
+
+    void set_valid_orientation(int piece, uint16_t valid_o) {
+        if (trail_.trail && valid_orientation_[piece] != valid_o) {
+            trail_.trail->push(Trail::ORIENTATION, piece,
+                               valid_orientation_[piece]);
+        }
+        valid_orientation_[piece] = valid_o;
+    }
+
+    void remove_orientation(int piece, int o) {
+        set_valid_orientation(piece, valid_orientation_[piece] & ~(1 << o));
+    }
+
+    void set_possible(int at, Mask possible) {
+        if (trail_.trail && !trail_.trail->possible_saved_ &&
+            possible_[at] != possible) {
+            trail_.trail->save_possible(possible_);
+        }
+        possible_[at] = possible;
+    }
+
+    void set_forced(int at, bool forced) {
+        if (trail_.trail && forced_[at] != forced) {
+            trail_.trail->push(Trail::FORCED, at, forced_[at]);
+        }
+        forced_[at] = forced;
+    }
+
+    int possible_count(int at) {
+        return __builtin_popcountl(possible_[at]);
+    }
+
+    static Mask piece_mask(int piece) {
+        return Mask(1) << piece;
+    }
+
+    static uint8_t piece_id(int piece) {
+        return piece + 1;
+    }
+
+    static int fixed_to_piece(uint8_t id) {
+        return id - 1;
+    }
+
+    int orientation_count(int piece) {
+        return __builtin_popcountl(valid_orientation_[piece]);
+    }
+
+    void update_possible() {
+        PerfScope perf(PERF_UPDATE_POSSIBLE);
+        for (int piece = 0; piece < N; ++piece) {
+            update_possible_for_piece(piece);
+        }
+    }
+
+    void update_possible_for_piece(int piece) {
+        Mask mask = piece_mask(piece);
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                int count = 0;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (!fixed_[at] || fixed_[at] == piece_id(piece)) {
+                        ++count;
+                    }
+                }
+                if (count == size) {
+                    for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                        set_possible(at, possible_[at] | mask);
+                    }
+                } else {
+                    remove_orientation(piece, o);
+                }
+            }
+        }
+    }
+
+    int update_forced_coverage_for_piece(int piece) {
+        Mask mask = piece_mask(piece);
+        int updated = 0;
+
+        for (int at : PieceIterator(hints_[piece])) {
+            if (!fixed_[at]) {
+                if ((forced_[at] && possible_[at] == mask)) {
+                    updated = 1;
+                    set_fixed(at, piece_id(piece));
+                    update_not_possible(at, mask, piece);
+                }
+            }
+        }
+
+        return updated;
+    }
+
+    int update_cant_fit_for_piece(int piece) {
+        Mask mask = piece_mask(piece);
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        int valid_count = 0;
+        std::array<uint8_t, W*H> count = { 0 };
+
+        if (!valid_o) {
+            return 0;
+        }
+
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                bool ok = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (!(possible_[at] & mask)) {
+                        ok = false;
+                    }
+                }
+                if (ok) {
+                    ++valid_count;
+                    for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                        count[at]++;
+                    }
+                }
+            }
+        }
+
+        int updated = 0;
+        for (int at : PieceIterator(hints_[piece])) {
+            if (!fixed_[at]) {
+                if (count[at] == valid_count) {
+                    updated = 1;
+                    set_fixed(at, piece_id(piece));
+                    update_not_possible(at, mask, piece);
+                }
+            }
+        }
+
+        return updated;
+    }
+
+    void update_not_possible(int update_at, Mask mask, int piece) {
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                bool no_intersect = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (at == update_at) {
+                        no_intersect = false;
+                    }
+                }
+                if (no_intersect) {
+                    remove_orientation(piece, o);
+                }
+            }
+        }
+    }
+
+    // The orientations of a piece that fit on the board without running
+    // into a square fixed to another piece.
+    int init_valid_orientations(int piece, const PieceArray& fixed) const {
+        int size = hints_[piece].second;
+        int ret = 0;
+        for (int o = 0; o < size * 2; ++o) {
+            int count = 0;
+            for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                if (!border(at) &&
+                    (!fixed[at] || fixed[at] == piece_id(piece))) {
+                    ++count;
+                }
+            }
+            bool fit2 = (count == size);
+            if (fit2) {
+                ret |= (1 << o);
+            }
+        }
+        return ret;
+    }
+
+    class PieceOrientationIterator {
+    public:
+        PieceOrientationIterator(Hint piece, int orientation) {
+            int at = piece.first;
+            int size = piece.second;
+            int offset = (size - 1) - (orientation >> 1);
+
+            step_ = ((orientation & 1) ? W : 1);
+            start_ = at - offset * step_;
+            end_ = start_ + size * step_;
+
+            if (start_ < 0 || end_ >= W * H + step_) {
+                start_ = end_ = -1;
+            }
+        }
+
+        struct iterator {
+            iterator(int i, int step) : i_(i), step_(step) {
+            }
+
+            bool operator!=(const iterator& other) const {
+                return i_ != other.i_;
+            }
+
+            int operator*() {
+                return i_;
+            }
+
+            int operator++() {
+                i_ += step_;
+                return i_;
+            }
+
+            int i_, step_;
+        };
+
+        iterator begin() {
+            return iterator(start_, step_);
+        }
+
+        iterator end() {
+            return iterator(end_, step_);
+        }
+
+    private:
+        int start_, end_, step_;
+    };
+
+    class PieceIterator {
+    public:
+        using Indices = std::array<int, 1 + 2*9 + 2*9>;
+
+        PieceIterator(Hint piece) {
+            int at = piece.first;
+            int size = piece.second;
+            is_[size_++] = at;
+
+            int r = at / W;
+            int c = at % W;
+            // The column.
+            for (int ri = std::max(0, r - (size - 1));
+                 ri < std::min(H, r + size);
+                 ++ri) {
+                int at2 = ri * W + c;
+                if (at2 != at)
+                    is_[size_++] = at2;
+            }
+            // The row.
+            for (int ci = std::max(0, c - (size - 1));
+                 ci < std::min(W, c + size);
+                 ++ci) {
+                int at2 = ci + r * W;
+                if (at2 != at)
+                    is_[size_++] = at2;
+            }
+        }
+
+        struct iterator {
+            iterator(int i, Indices* is) : i_(i), is_(is) {
+            }
+
+            bool operator!=(const iterator& other) const {
+                return i_ != other.i_ || is_ != other.is_;
+            }
+
+            int operator*() {
+                return (*is_)[i_];
+            }
+
+            void operator++() {
+                i_++;
+            }
+
+            int i_;
+            Indices* is_;
+        };
+
+        iterator begin() {
+            return iterator(0, &is_);
+        }
+
+        iterator end() {
+            return iterator(size_, &is_);
+        }
+
+    private:
+        int size_ = 0;
+        Indices is_;
+    };
+
+    int update_uncontested_no_cover() {
+        PerfScope perf(PERF_UNCONTESTED_NO_COVER);
+        int count = 0;
+        for (int piece = 0; piece < N; ++piece) {
+            int omask = find_uncontested_no_cover(piece);
+            if (!omask)
+                continue;
+            // Found a viable uncontested orientation for the piece.
+            set_valid_orientation(piece, omask);
+            {
+                int o = __builtin_ctzl(omask);
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (!fixed_[at]) {
+                        set_fixed(at, piece_id(piece));
+                        update_not_possible(at,
+                                            piece_mask(piece),
+                                            piece);
+                    }
+                }
+            }
+            return 1;
+        }
+        return count;
+    }
+
+    int find_uncontested_no_cover(int piece) {
+        // If a piece can't be used to cover any more dots, see if there
+        // are any totally uncontested orientations. If there is one,
+        // just choose it as the actual orientation.
+
+        Mask mask = piece_mask(piece);
+        bool have_contested = false;
+
+        // Bail out early if the piece can still be used to cover a
+        // dot.
+        for (int at : PieceIterator(hints_[piece])) {
+            if (!fixed_[at] && forced_[at] &&
+                (possible_[at] & mask)) {
+                return 0;
+            }
+            if ((possible_[at] & mask) && possible_[at] != mask) {
+                have_contested = true;
+            }
+        }
+
+        // If none of the orientations are contested, this is an
+        // uninteresting case.
+        if (!have_contested) {
+            return 0;
+        }
+
+        // Iterate through all orientations of the piece. Look how many
+        // match orientation A from the intro, how many B/C.
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                // In this orientation either all squares are already
+                // covered by this piece, or can only be covered by
+                // this piece.
+                bool ok = true;
+                bool non_fixed = false;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (fixed_[at]) {
+                        if (fixed_[at] != piece_id(piece))
+                            ok = false;
+                    } else {
+                        non_fixed = true;
+                        if (possible_[at] != mask)
+                            ok = false;
+                    }
+                }
+                if (ok && non_fixed) {
+                    return 1 << o;
+                }
+            }
+        }
+
+        return 0;
+    }
+
+    int update_knowledge_of_single_solution() {
+        PerfScope perf(PERF_SINGLE_SOLUTION);
+        int count = 0;
+        for (int piece = 0; piece < N; ++piece) {
+            count += find_knowledge_of_single_solution(piece);
+        }
+        return count;
+    }
+
+    int find_knowledge_of_single_solution(int piece) {
+        // Given a piece P, split the valid orientations into two
+        // groups.  Those where P overlaps with either a dot or a
+        // valid orientation of some other piece (have information),
+        // and those where it doesn't (no information).
+        //
+        // If there are multiple "no information" orientations, a
+        // level generator using a single solution can't possibly
+        // distinguish between them. Any squares covered by all of the
+        // "have information" orientations must therefore be part
+        // of the solution.
+
+        DepMask have_information_union;
+        int have_information_count = 0;
+        int no_information_count = 0;
+
+        // Iterate through all orientations of the piece. Look how many
+        // match orientation A from the intro, how many B/C.
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                DepMask covered;
+                bool ok = true;
+                bool overlaps_forced = false;
+                bool cant_overlap_with_other_pieces = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    covered.set(at);
+                    if (!fixed_[at]) {
+                        if (forced_[at])
+                            overlaps_forced = true;
+                        if (possible_count(at) != 1)
+                            cant_overlap_with_other_pieces = false;
+                    } else if (fixed_[at] != piece_id(piece)) {
+                        ok = false;
+                    }
+                }
+                if (!ok) {
+                    continue;
+                }
+                if (overlaps_forced) {
+                    if (have_information_count++) {
+                        have_information_union &= covered;
+                    } else {
+                        have_information_union = covered;
+                    }
+                } else if (!overlaps_forced &&
+                           cant_overlap_with_other_pieces) {
+                    no_information_count++;
+                }
+            }
+        }
+
+        if (no_information_count > 1) {
+            int update_count = 0;
+            for (int at : PieceIterator(hints_[piece])) {
+                if (fixed_[at])
+                    continue;
+                if (have_information_union[at]) {
+                    set_fixed(at, piece_id(piece));
+                    update_not_possible(at, piece_mask(piece), piece);
+                    ++update_count;
+                }
+             }
+            return update_count;
+        }
+        return 0;
+    }
+
+    // Find dependencies. E.g.:
+    //
+    //   53.. 4
+    //    5 2
+    //
+    // Above any row that covers the left dot must also cover the right
+    // dot. So the 2 can't go up to cover the right dot.
+    void update_dependent() {
+        PerfScope perf(PERF_DEPENDENT);
+        for (int at = 0; at < W * H; ++at) {
+            if (!forced_[at])
+                continue;
+            if (fixed_[at])
+                continue;
+            if (possible_count(at) <= 1)
+                continue;
+            DepMask dep;
+            dep.set();
+            for (int piece = 0; piece < N; ++piece) {
+                if (!(piece_mask(piece) & possible_[at]))
+                    continue;
+                dep &= find_dependent(piece, at);
+            }
+            if (dep.count() > 1) {
+                for (int target = 0; target < N; ++target) {
+                    if (dep[target] &&
+                        target != at &&
+                        possible_[at] != possible_[target]) {
+                        if (forced_[target]) {
+                            Mask both = possible_[target] & possible_[at];
+                            set_possible(target, both);
+                            set_possible(at, both);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    DepMask find_one_of(int piece, int target) {
+        return find_dependent(piece, target, false);
+    }
+
+    DepMask find_dependent(int piece, int target,
+                           bool wanted_overlap = true) {
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        DepMask ret;
+        ret.set();
+
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                bool overlaps_target = false;
+                bool ok = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (at == target)
+                        overlaps_target = true;
+                    if (fixed_[at] && fixed_[at] != piece_id(piece))
+                        ok = false;
+                }
+                if (overlaps_target == wanted_overlap && ok) {
+                    DepMask mask;
+                    for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                        mask[at] = true;
+                    }
+                    ret &= mask;
+                }
+            }
+        }
+
+        // With no matching orientation, every square counts as
+        // dependent. This used to be reset to none by a flag that was
+        // never initialized, which in practice left it set, and the
+        // puzzledb classifications depend on that.
+        return ret;
+    }
+
+    //      Y   5
+    //    X 4   Z
+    //
+    // 4 needs to cover either Y or Z, so can't cover X.
+    void update_square() {
+        PerfScope perf(PERF_SQUARE);
+        for (int piece = 0; piece < N; ++piece) {
+            int size = hints_[piece].second;
+            typename PieceIterator::Indices covered;
+            int covered_count = 0;
+            for (int at : PieceIterator(hints_[piece])) {
+                if (!forced_[at] || fixed_[at] ||
+                    possible_count(at) != 2)
+                    continue;
+                if (!(possible_[at] & piece_mask(piece)))
+                    continue;
+                covered[covered_count++] = at;
+            }
+            // Find pairs of squares where:
+            // - Both can be covered by the candidate and one other
+            //   piece (the same in both cases).
+            // - The candidate piece can't cover both squares at the same
+            //   time. (That will implicitly mean that the other piece
+            //   can't do it either).
+            for (int i = 0; i < covered_count; ++i) {
+                for (int j = i + 1; j < covered_count; ++j) {
+                    int ai = covered[i], aj = covered[j];
+                    if (distance(ai, aj) <= size)
+                        continue;
+                    Mask pi = possible_[ai], pj = possible_[aj];
+                    if (pi != pj)
+                        continue;
+                    // Remove any orientations of the piece that
+                    // don't cover at least one of the two squares.
+                    int valid_o = valid_orientation_[piece];
+                    for (int o = 0; o < size * 2; ++o) {
+                        if (valid_o & (1 << o)) {
+                            bool no_candidate = true;
+                            for (int at :
+                                 PieceOrientationIterator(hints_[piece], o)) {
+                                if (at == ai || at == aj)
+                                    no_candidate = false;
+                            }
+                            if (no_candidate) {
+                                remove_orientation(piece, o);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Find dependencies. E.g.:
+    //
+    //----
+    //  y2
+    //  3.
+    //  Y2
+    // ---
+    //
+    // Both 2s can't be vertical, so either Y or y must be
+    // filled. So 3 must be horizontal.
+    void update_one_of() {
+        PerfScope perf(PERF_ONE_OF);
+        for (int at = 0; at < W * H; ++at) {
+            // Find squares where two pieces on the same
+            // row / column can intersect.
+            if (fixed_[at])
+                continue;
+            if (possible_count(at) < 2)
+                continue;
+            int piece_a = 0, piece_b = 0;
+            // This is slightly suboptimal that it'll only
+            // find one pair of potential a / b piece, not
+            // pairs.
+            if (!find_pieces_on_same_row_or_column(at,
+                                                   &piece_a,
+                                                   &piece_b))
+                continue;
+            // For each of those two pieces, find the set of squares
+            // that they must pass through if they don't go through
+            // the intersecting square.
+            DepMask a = find_one_of(piece_a, at);
+            DepMask b = find_one_of(piece_b, at);
+            Mask target_pieces_a = 0;
+            Mask target_pieces_b = 0;
+            // Then see if there exists a piece that could
+            // intersect with both of the above sets.
+            for (int target = 0; target < W * H; ++target) {
+                if (!a[target] && !b[target])
+                    continue;
+                for (int piece = 0; piece < N; ++piece) {
+                    if (piece == piece_a || piece == piece_b)
+                        continue;
+                    if (piece_mask(piece) & possible_[target]) {
+                        if (a[target])
+                            target_pieces_a |= piece_mask(piece);
+                        if (b[target])
+                            target_pieces_b |= piece_mask(piece);
+                    }
+                }
+            }
+            Mask target_pieces_both = target_pieces_a &
+                target_pieces_b;
+            if (target_pieces_both) {
+                // If such a piece exists, check if the piece
+                // can intersect with both sets at the same time.
+                // If it can, exclude any such orientations.
+                for (int piece = 0; piece < N; ++piece) {
+                    if (piece_mask(piece) & target_pieces_both) {
+                        exclude_if_in_both_sets(piece, a, b);
+                    }
+                }
+            }
+        }
+    }
+
+    bool find_pieces_on_same_row_or_column(int at, int* a, int* b) {
+        int possible = possible_[at];
+        for (int i = 0; i < N; ++i) {
+            if (!(possible & piece_mask(i)))
+                continue;
+            for (int j = i + 1; j < N; ++j) {
+                if (!(possible & piece_mask(j)))
+                    continue;
+                int a_at = hints_[i].first;
+                int b_at = hints_[j].first;
+                if ((a_at / W == b_at / W) ||
+                    (a_at % W == b_at % W)) {
+                    *a = i;
+                    *b = j;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    void exclude_if_in_both_sets(int piece,
+                                 const DepMask& a,
+                                 const DepMask& b) {
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                bool a_hit = false, b_hit = false;
+                bool ok = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (a[at]) a_hit = true;
+                    if (b[at]) b_hit = true;
+                    if (fixed_[at] && fixed_[at] != piece_id(piece)) {
+                        ok = false;
+                    }
+                }
+                if (ok && a_hit && b_hit) {
+                    remove_orientation(piece, o);
+                }
+            }
+        }
+    }
+
+    int distance(int a, int b) {
+        int ra = a / W, rb = b / W,
+            ca = a % W, cb = b % W;
+        int rd = std::abs(ra - rb), cd = std::abs(ca - cb);
+        if (rd && cd) {
+            return W + H + 1;
+        }
+        return rd + cd;
+    }
+
+    std::array<Hint, N> hints_;
+    // The orientations of each piece that fit between the hints, before
+    // any deductions.
+    uint16_t hint_orientation_[N] { 0 };
+    uint16_t valid_orientation_[N] { 0 };
+    MaskArray possible_ = { 0 };
+    PieceArray fixed_ = { 0 };
+    SquareSet forced_;
+    // The pieces whose hints mutate() changed, and the squares that
+    // hints moved from or to, until finish_mutation().
+    Mask mutated_ = 0;
+    std::array<Square, 6> moved_;
+    uint8_t moved_count_ = 0;
+
+    struct TrailPointer {
+        TrailPointer() {
+        }
+        TrailPointer(const TrailPointer&) {
+        }
+        TrailPointer& operator=(const TrailPointer&) {
+            trail = nullptr;
+            return *this;
+        }
+
+        Trail* trail = nullptr;
+    } trail_;
+};
+
+#endif // LINJAT_GAME_H
@@ -0,0 +1,250 @@
+#include "generator.h"
+
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+
+#include "linjat.h"
+
+thread_local GeneratorOptions generator_options;
+thread_local GenerationStats stats;
+thread_local Deadline run_deadline;
+thread_local Deadline puzzle_deadline;
+thread_local PuzzleHashSet seen_puzzles;
+thread_local FILE* output = stdout;
+thread_local BufferStream record_buffer;
+thread_local int64_t written_since_sync = 0;
+thread_local std::chrono::steady_clock::time_point last_checkpoint =
+    std::chrono::steady_clock::now();
+thread_local Rng rng;
+
+bool reset_generator() {
+    const std::string& quotas = generator_options.quotas;
+    stats = GenerationStats();
+    size_t start = 0;
+    while (start < quotas.size()) {
+        size_t end = std::min(quotas.find(';', start), quotas.size());
+        stats.quotas.emplace_back();
+        if (!Quota::parse(quotas.substr(start, end - start),
+                          &stats.quotas.back())) {
+            return false;
+        }
+        start = end + 1;
+    }
+    ScoreFormula formula;
+    if (!ScoreFormula::parse(generator_options.collection_score, &formula)) {
+        return false;
+    }
+
+    run_deadline = Deadline();
+    puzzle_deadline = Deadline();
+    seen_puzzles = PuzzleHashSet();
+    output = stdout;
+    written_since_sync = 0;
+    last_checkpoint = std::chrono::steady_clock::now();
+    rng.reseed(generator_options.seed);
+    return true;
+}
+
+namespace {
+
+std::atomic<bool> stop_requested(false);
+
+void request_stop(int) {
+    stop_requested = true;
+}
+
+}
+
+void stop_on_signals() {
+    struct sigaction action = {};
+    action.sa_handler = request_stop;
+    action.sa_flags = SA_RESETHAND;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+bool start_puzzle() {
+    if (stats.failed) {
+        return false;
+    }
+    if (stop_requested) {
+        stats.interrupted = true;
+        return false;
+    }
+    if (run_deadline.passed()) {
+        stats.out_of_time = true;
+        return false;
+    }
+    puzzle_deadline = Deadline::after_ms(generator_options.time_budget_ms)
+        .earliest(run_deadline);
+    return true;
+}
+
+void sync_output() {
+    output_writer.flush(output);
+    if (output != stdout) {
+        fsync(fileno(output));
+    }
+    written_since_sync = 0;
+}
+
+bool checkpoint_due() {
+    if (generator_options.checkpoint_file.empty()) {
+        return false;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - last_checkpoint;
+    return written_since_sync >= generator_options.output_batch ||
+        elapsed >= std::chrono::seconds(
+            generator_options.checkpoint_interval_s);
+}
+
+int64_t json_int(const std::string& object, const std::string& key) {
+    std::string value;
+    json_object_value(object, key, &value);
+    return atoll(value.c_str());
+}
+
+void close_output() {
+    sync_output();
+    if (output != stdout) {
+        fclose(output);
+    }
+    // The run is complete, there's nothing to resume.
+    if (!generator_options.checkpoint_file.empty() && !stats.interrupted &&
+        !stats.failed) {
+        remove(generator_options.checkpoint_file.c_str());
+    }
+}
+
+namespace {
+
+// How fast operator qualities follow the rewards, and the smallest
+// probability any operator is picked with.
+const double kAdaptationRate = 0.05;
+const double kMinProbability = 0.04;
+
+const char* kMutationOpNames[MUTATION_OP_COUNT] = {
+    "shrink",
+    "grow",
+    "relocate",
+    "swap",
+    "nudge",
+    "move_dot",
+};
+
+const char* kCandidateRejectNames[CANDIDATE_REJECT_COUNT] = {
+    "orientation",
+    "overlap",
+    "fit",
+    "unsolved",
+    "unclassified",
+    "trivial",
+};
+
+}
+
+const char* mutation_op_name(MutationOp op) {
+    return kMutationOpNames[op];
+}
+
+const char* candidate_reject_name(CandidateReject reject) {
+    return kCandidateRejectNames[reject];
+}
+
+MutationSelector::MutationSelector(bool adaptive) : adaptive_(adaptive) {
+    // Optimistic, so that every operator gets tried early on.
+    quality_.fill(1.0);
+}
+
+MutationOp MutationSelector::pick() const {
+    double total = 0;
+    for (double quality : quality_) {
+        total += quality;
+    }
+    double spread = 1 - MUTATION_OP_COUNT * kMinProbability;
+    double x = rng() / 2147483648.0;
+    for (int op = 0; op < MUTATION_OP_COUNT - 1; ++op) {
+        double share = total > 0 ? quality_[op] / total :
+            1.0 / MUTATION_OP_COUNT;
+        x -= kMinProbability + spread * share;
+        if (x < 0) {
+            return MutationOp(op);
+        }
+    }
+    return MutationOp(MUTATION_OP_COUNT - 1);
+}
+
+void MutationSelector::reward(const std::vector<MutationOp>& ops,
+                              bool solved, bool improved) {
+    // Half for being solvable, half for a new best.
+    double reward = 0.5 * solved + 0.5 * improved;
+    for (MutationOp op : ops) {
+        quality_[op] += kAdaptationRate * (reward - quality_[op]);
+    }
+}
+
+std::string MutationSelector::save() const {
+    std::string ret;
+    char buf[32];
+    for (double quality : quality_) {
+        snprintf(buf, sizeof(buf), "%s%.17g", ret.empty() ? "" : ",",
+                 quality);
+        ret += buf;
+    }
+    return ret;
+}
+
+bool MutationSelector::restore(const std::string& saved) {
+    const char* at = saved.c_str();
+    for (double& quality : quality_) {
+        char* end;
+        quality = strtod(at, &end);
+        if (end == at) {
+            return false;
+        }
+        at = *end == ',' ? end + 1 : end;
+    }
+    return true;
+}
+
+unsigned active_rules(const GeneratorOptions& options) {
+    unsigned rules = ALL_RULES & ~options.disabled_rules;
+    if (options.disable_unscored_rules) {
+        if (!options.score_square) {
+            rules &= ~RULE_SQUARE;
+        }
+        if (!options.score_dep) {
+            rules &= ~RULE_DEPENDENCY;
+        }
+        if (!options.score_one_of) {
+            rules &= ~RULE_ONE_OF;
+        }
+    }
+    return rules;
+}
+
+int weighted_score(const Classification& cls,
+                   const GeneratorOptions& options) {
+    return
+        (cls.cover.depth * options.score_cover) +
+        (cls.cant_fit.depth * options.score_cant_fit) +
+        (cls.square.depth * options.score_square) +
+        (cls.dep.depth * options.score_dep) +
+        (cls.one_of.depth * options.score_one_of) +
+        (cls.single_solution.depth * options.score_single_solution) +
+        (cls.uncontested_no_cover.depth *
+         options.score_uncontested_no_cover) +
+        (cls.all.max_width * options.score_max_width);
+}
+
+void pareto_objectives(const Classification& cls, int16_t* objectives) {
+    objectives[0] = cls.cover.depth;
+    objectives[1] = cls.cant_fit.depth;
+    objectives[2] = cls.square.depth;
+    objectives[3] = cls.dep.depth;
+    objectives[4] = cls.one_of.depth;
+    objectives[5] = -cls.single_solution.depth;
+    objectives[6] = -cls.uncontested_no_cover.depth;
+    objectives[7] = -cls.all.max_width;
+}
@@ -0,0 +1,1833 @@
+#ifndef LINJAT_GENERATOR_H
+#define LINJAT_GENERATOR_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "classification.h"
+#include "dedup.h"
+#include "game.h"
+#include "generator_options.h"
+#include "perf.h"
+#include "puzzledb.h"
+#include "queue.h"
+#include "rng.h"
+#include "writer.h"
+
+// The generator state is per thread, so that --manifest can do several
+// runs at once.
+extern thread_local GeneratorOptions generator_options;
+
+// The rules that the options leave in, as a Rule bitmask.
+unsigned active_rules(const GeneratorOptions& options);
+
+template <class G>
+G add_forced_squares(G game, FILE* fp) {
+    PerfScope perf(PERF_DOT_PLACEMENT);
+    const typename G::CountArray orig_possible_count =
+        game.orig_possible_counts();
+    if (fp)
+        game.print_json(fp, "");
+    for (int i = 0; i < 100; ++i) {
+        if (game.force_if_uncontested(orig_possible_count) && fp)
+            game.print_json(fp, "\"type\":\"ambiguate\",");
+        auto res = game.iterate(active_rules(generator_options));
+        if (res.first == DeductionKind::NONE) {
+            if (!game.force_one_square(orig_possible_count)) {
+                break;
+            }
+            if (fp)
+                game.print_json(fp, "\"type\":\"add dot\",");
+        } else {
+            if (fp)
+                game.print_json(fp, "");
+        }
+        if (game.impossible()) {
+            break;
+        }
+        // game.print_puzzle(false);
+    }
+
+    return game;
+}
+
+const char* mutation_op_name(MutationOp op);
+
+// The ways that a random game can fail to become a candidate, in the
+// order create_candidate_game() checks for them. The first three are
+// only checked with --fast_reject, before placing dots: a piece with
+// no orientation that fits, too few squares that two pieces could
+// cover, and pieces that can't all be placed at once. Then placing
+// dots might not lead to a solution, the solution might not survive
+// classification, or the puzzle might need none of the square, dep
+// and one-of rules that the scores ask for.
+enum CandidateReject {
+    REJECT_ORIENTATION,
+    REJECT_OVERLAP,
+    REJECT_FIT,
+    REJECT_UNSOLVED,
+    REJECT_UNCLASSIFIED,
+    REJECT_TRIVIAL,
+    CANDIDATE_REJECT_COUNT,
+};
+
+const char* candidate_reject_name(CandidateReject reject);
+
+// Picks the mutation operators for minimize_width(). Unless adaptive,
+// this is the original scheme, uniform over the first three operators.
+// When adaptive, it does adaptive operator selection by probability
+// matching: each operator's quality is a recency-weighted average of
+// the rewards of the mutants it went into, and operators are picked
+// with probability proportional to quality, with a floor so that none
+// is starved.
+class MutationSelector {
+public:
+    explicit MutationSelector(bool adaptive);
+
+    bool adaptive() const {
+        return adaptive_;
+    }
+
+    MutationOp pick() const;
+
+    // Credit the operators of a mutant that was solvable, and maybe
+    // improved on the best score.
+    void reward(const std::vector<MutationOp>& ops, bool solved,
+                bool improved);
+
+    std::string save() const;
+    bool restore(const std::string& saved);
+
+private:
+    bool adaptive_;
+    std::array<double, MUTATION_OP_COUNT> quality_;
+};
+
+struct GenerationStats {
+    // Calls to add_forced_squares() made while looking for candidates.
+    int64_t candidate_attempts = 0;
+    int64_t candidates = 0;
+    // The random games rejected at each step of the candidate search,
+    // and the time the search took.
+    std::array<int64_t, CANDIDATE_REJECT_COUNT> candidate_rejects = { 0 };
+    double candidate_ms = 0;
+    // Optimized puzzles, and how many of those were thrown away
+    // since no open quota wanted them.
+    int64_t puzzles = 0;
+    int64_t wasted = 0;
+    // Optimized puzzles dropped by --dedup.
+    int64_t duplicates = 0;
+    // Candidate searches that gave up, and optimizations cut short, by
+    // running out of attempts or time.
+    int64_t candidate_failures = 0;
+    int64_t time_limited = 0;
+    bool out_of_time = false;
+    // The candidate search ran out of attempts, or the open quotas
+    // looked out of reach, and the run stopped.
+    bool gave_up = false;
+    // The run was stopped by SIGINT or SIGTERM.
+    bool interrupted = false;
+    // A checkpoint couldn't be written, and the run stopped.
+    bool failed = false;
+    int64_t optimize_iterations = 0;
+    double optimize_ms = 0;
+    // Mutants that were a puzzle the optimizer had already classified,
+    // whose classification was reused, and the ones that weren't.
+    int64_t classify_cache_hits = 0;
+    int64_t classify_cache_misses = 0;
+    std::vector<Quota> quotas;
+    // With --shard, the number of this shard's puzzle indices done.
+    int64_t shard_position = 0;
+
+    // For each mutation operator, the number of mutants it went into,
+    // and how many of those were solvable, and so accepted into the
+    // population, or beat the best score so far.
+    struct MutationCounts {
+        int64_t used = 0;
+        int64_t accepted = 0;
+        int64_t improved = 0;
+    };
+    std::array<MutationCounts, MUTATION_OP_COUNT> mutations;
+    // Optimizer iterations where none of the picked operators could
+    // change the game, so there was no mutant to try.
+    int64_t wasted_mutations = 0;
+
+    // Times the optimizer went --plateau_iterations without improving,
+    // with the number of distinct puzzles in its population summed
+    // over those times, and what it did about it.
+    int64_t plateaus = 0;
+    int64_t plateau_diversity = 0;
+    int64_t restarts = 0;
+    int64_t early_stops = 0;
+    // The optimizer iterations used for each puzzle, and the score it
+    // ended up with, in order.
+    std::vector<int> puzzle_iterations;
+    std::vector<int> puzzle_scores;
+
+    // With --pipeline, for each stage: its threads, the time they spent
+    // working and the time they could have, and the mean number of
+    // puzzles waiting for the stage.
+    struct PipelineStage {
+        int threads = 0;
+        double busy_ms = 0;
+        double wall_ms = 0;
+        double mean_queued = 0;
+
+        double occupancy() const {
+            return wall_ms > 0 ? busy_ms / wall_ms : 0.0;
+        }
+    };
+    std::array<PipelineStage, 3> pipeline;
+
+    // Add the counts of another thread's work on the same run.
+    void add(const GenerationStats& other) {
+        candidate_attempts += other.candidate_attempts;
+        candidates += other.candidates;
+        for (int i = 0; i < CANDIDATE_REJECT_COUNT; ++i) {
+            candidate_rejects[i] += other.candidate_rejects[i];
+        }
+        candidate_ms += other.candidate_ms;
+        puzzles += other.puzzles;
+        wasted += other.wasted;
+        duplicates += other.duplicates;
+        candidate_failures += other.candidate_failures;
+        time_limited += other.time_limited;
+        out_of_time = out_of_time || other.out_of_time;
+        gave_up = gave_up || other.gave_up;
+        interrupted = interrupted || other.interrupted;
+        failed = failed || other.failed;
+        optimize_iterations += other.optimize_iterations;
+        optimize_ms += other.optimize_ms;
+        classify_cache_hits += other.classify_cache_hits;
+        classify_cache_misses += other.classify_cache_misses;
+        for (int op = 0; op < MUTATION_OP_COUNT; ++op) {
+            mutations[op].used += other.mutations[op].used;
+            mutations[op].accepted += other.mutations[op].accepted;
+            mutations[op].improved += other.mutations[op].improved;
+        }
+        wasted_mutations += other.wasted_mutations;
+        plateaus += other.plateaus;
+        plateau_diversity += other.plateau_diversity;
+        restarts += other.restarts;
+        early_stops += other.early_stops;
+        puzzle_iterations.insert(puzzle_iterations.end(),
+                                 other.puzzle_iterations.begin(),
+                                 other.puzzle_iterations.end());
+        puzzle_scores.insert(puzzle_scores.end(),
+                             other.puzzle_scores.begin(),
+                             other.puzzle_scores.end());
+    }
+
+    void print_json(FILE* fp) const {
+        fprintf(fp, "{\"candidate_attempts\": %ld, \"candidates\": %ld, "
+                "\"puzzles\": %ld, \"wasted\": %ld, "
+                "\"wasted_ratio\": %.4f, \"duplicates\": %ld, "
+                "\"candidate_failures\": %ld, \"time_limited\": %ld, "
+                "\"out_of_time\": %s, \"gave_up\": %s, "
+                "\"interrupted\": %s, \"failed\": %s, "
+                "\"optimize_iterations\": %ld, "
+                "\"optimize_iteration_us\": %.1f, "
+                "\"classify_cache_hits\": %ld, "
+                "\"classify_cache_misses\": %ld, "
+                "\"classify_cache_hit_rate\": %.4f",
+                candidate_attempts, candidates, puzzles, wasted,
+                puzzles ? double(wasted) / puzzles : 0.0, duplicates,
+                candidate_failures, time_limited,
+                out_of_time ? "true" : "false", gave_up ? "true" : "false",
+                interrupted ? "true" : "false", failed ? "true" : "false",
+                optimize_iterations,
+                optimize_iterations ?
+                1000 * optimize_ms / optimize_iterations : 0.0,
+                classify_cache_hits, classify_cache_misses,
+                classify_cache_hits ?
+                double(classify_cache_hits) /
+                (classify_cache_hits + classify_cache_misses) : 0.0);
+        if (!quotas.empty()) {
+            fprintf(fp, ", \"quotas\": [");
+            for (int i = 0; i < quotas.size(); ++i) {
+                fprintf(fp, i ? ", " : "");
+                quotas[i].print_json(fp);
+            }
+            fprintf(fp, "]");
+        }
+        fprintf(fp, ", \"mutations\": {");
+        for (int op = 0; op < MUTATION_OP_COUNT; ++op) {
+            const MutationCounts& counts = mutations[op];
+            fprintf(fp, "%s\"%s\": {\"used\": %ld, \"accepted\": %ld, "
+                    "\"improved\": %ld, \"accept_rate\": %.4f, "
+                    "\"improve_rate\": %.4f}", op ? ", " : "",
+                    mutation_op_name(MutationOp(op)), counts.used,
+                    counts.accepted, counts.improved,
+                    counts.used ? double(counts.accepted) / counts.used : 0.0,
+                    counts.used ? double(counts.improved) / counts.used : 0.0);
+        }
+        fprintf(fp, "}, \"wasted_mutations\": %ld, \"candidate_rejects\": {",
+                wasted_mutations);
+        for (int i = 0; i < CANDIDATE_REJECT_COUNT; ++i) {
+            fprintf(fp, "%s\"%s\": %ld", i ? ", " : "",
+                    candidate_reject_name(CandidateReject(i)),
+                    candidate_rejects[i]);
+        }
+        fprintf(fp, "}, \"candidates_per_s\": %.1f",
+                candidate_ms > 0 ? 1000 * candidates / candidate_ms : 0.0);
+        fprintf(fp, ", \"plateaus\": %ld, \"plateau_diversity\": %ld, "
+                "\"mean_plateau_diversity\": %.2f, \"restarts\": %ld, "
+                "\"early_stops\": %ld, \"puzzle_iterations\": [",
+                plateaus, plateau_diversity,
+                plateaus ? double(plateau_diversity) / plateaus : 0.0,
+                restarts, early_stops);
+        for (int i = 0; i < puzzle_iterations.size(); ++i) {
+            fprintf(fp, "%s%d", i ? ", " : "", puzzle_iterations[i]);
+        }
+        fprintf(fp, "], \"puzzle_scores\": [");
+        for (int i = 0; i < puzzle_scores.size(); ++i) {
+            fprintf(fp, "%s%d", i ? ", " : "", puzzle_scores[i]);
+        }
+        fprintf(fp, "]");
+        if (generator_options.shard_count) {
+            fprintf(fp, ", \"shard_position\": %ld", shard_position);
+        }
+        if (generator_options.pipeline_optimize_threads) {
+            static const char* names[] = { "candidate", "optimize",
+                                           "finish" };
+            fprintf(fp, ", \"pipeline\": {");
+            for (int i = 0; i < pipeline.size(); ++i) {
+                fprintf(fp, "%s\"%s\": {\"threads\": %d, "
+                        "\"occupancy\": %.3f, \"mean_queued\": %.2f}",
+                        i ? ", " : "", names[i], pipeline[i].threads,
+                        pipeline[i].occupancy(), pipeline[i].mean_queued);
+            }
+            fprintf(fp, "}");
+        }
+        if (generator_options.perf_counters) {
+            fprintf(fp, ", \"perf_counters\": ");
+            perf_counters.print_json(fp);
+        }
+        fprintf(fp, "}\n");
+    }
+};
+
+extern thread_local GenerationStats stats;
+
+// A point in time after which generation should wrap up with what it
+// has.
+class Deadline {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // A deadline budget_ms from now, or never if budget_ms is 0.
+    static Deadline after_ms(int budget_ms) {
+        Deadline ret;
+        if (budget_ms > 0) {
+            ret.at_ = Clock::now() + std::chrono::milliseconds(budget_ms);
+        }
+        return ret;
+    }
+
+    Deadline earliest(const Deadline& other) const {
+        return at_ < other.at_ ? *this : other;
+    }
+
+    bool passed() const {
+        return at_ != Clock::time_point::max() && Clock::now() >= at_;
+    }
+
+private:
+    Clock::time_point at_ = Clock::time_point::max();
+};
+
+extern thread_local Deadline run_deadline;
+extern thread_local Deadline puzzle_deadline;
+
+// Canonical hashes of the puzzles output so far, for --dedup.
+extern thread_local PuzzleHashSet seen_puzzles;
+
+// Where the generated puzzles go. Each record is formatted into
+// record_buffer and then queued to the output_writer thread.
+extern thread_local FILE* output;
+extern thread_local BufferStream record_buffer;
+extern thread_local int64_t written_since_sync;
+
+// A checkpoint has the RNG state, the stats (which include how many
+// puzzles have been written) and the minimize_width() population in
+// progress. Puzzles written before the checkpoint are synced to disk
+// first, and anything after that is truncated away on --resume.
+extern thread_local std::chrono::steady_clock::time_point last_checkpoint;
+
+// Reset all of the above for a new run with generator_options, and
+// seed the RNG. Returns false, after printing why, if the quotas or
+// the collection score don't parse.
+bool reset_generator();
+
+// Start the clock for a new puzzle. Returns false if the run is out
+// of time or has been interrupted.
+bool start_puzzle();
+
+void sync_output();
+bool checkpoint_due();
+int64_t json_int(const std::string& object, const std::string& key);
+
+// Close the output after a run. The checkpoint is kept only if the
+// run was interrupted.
+void close_output();
+
+// Returns false if the puzzle (or one of its mirror images) has
+// already been output, and should be dropped.
+template <class G>
+bool is_new_puzzle(const G& game) {
+    if (!generator_options.dedup) {
+        return true;
+    }
+    PuzzleHash hash = canonical_hash(game.puzzle_rows());
+    // A shard can't see the puzzles of the others, so whether a puzzle
+    // is kept can't depend on the shard's own earlier puzzles either.
+    // Only --dedup_against applies, and --merge_shards does the rest.
+    if (generator_options.shard_count ? !seen_puzzles.contains(hash) :
+        seen_puzzles.insert(hash)) {
+        return true;
+    }
+    ++stats.duplicates;
+    return false;
+}
+
+// The minimize_width() call in progress when a checkpoint is taken.
+// Only the saved states are kept, since constructing a Game would
+// draw from the RNG.
+struct InFlight {
+    std::string candidate;
+    int iteration = 0;
+    std::vector<std::string> population;
+    std::string selector;
+    std::vector<std::string> archive;
+    // Iterations since the best score last improved, the restarts done
+    // so far, and the best game from before them, if any.
+    int stalled = 0;
+    int restarts = 0;
+    std::string best;
+};
+
+// The same, but restored from --checkpoint_file for the first
+// minimize_width() call after --resume.
+template <class G>
+struct Resumed {
+    G candidate;
+    int iteration = 0;
+    std::vector<G> population;
+    std::string selector;
+    std::vector<G> archive;
+    int stalled = 0;
+    int restarts = 0;
+    std::vector<G> best;
+};
+template <class G>
+thread_local std::unique_ptr<Resumed<G>> resumed;
+
+template <class G>
+std::string checkpoint_config() {
+    const GeneratorOptions& options = generator_options;
+    char buf[128];
+    snprintf(buf, sizeof(buf), "h=%d_w=%d_p=%d_seed=%d",
+             G::H, G::W - 1, G::N, options.seed);
+    std::string config = buf;
+    if (options.shard_count) {
+        config += "_shard=" + std::to_string(options.shard_index) + "/" +
+            std::to_string(options.shard_count);
+    }
+    return config;
+}
+
+// Replace --checkpoint_file with the current state. If that fails, the
+// run stops before its next puzzle, and the old checkpoint is kept.
+template <class G>
+void write_checkpoint(const InFlight* in_flight) {
+    const std::string& file = generator_options.checkpoint_file;
+    sync_output();
+    long offset = ftell(output);
+
+    std::string tmp = file + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "w");
+    if (!fp) {
+        perror(tmp.c_str());
+        stats.failed = true;
+        return;
+    }
+    fprintf(fp, "{\"config\": %s, \"output_offset\": %ld, "
+            "\"rng\": %s, \"stats\": ",
+            json_string(checkpoint_config<G>()).c_str(), offset,
+            json_string(rng.save()).c_str());
+    stats.print_json(fp);
+    if (in_flight) {
+        fprintf(fp, ", \"in_flight\": {\"iteration\": %d, "
+                "\"candidate\": %s, \"selector\": %s, \"population\": [",
+                in_flight->iteration,
+                json_string(in_flight->candidate).c_str(),
+                json_string(in_flight->selector).c_str());
+        for (int i = 0; i < in_flight->population.size(); ++i) {
+            fprintf(fp, "%s%s", i ? ", " : "",
+                    json_string(in_flight->population[i]).c_str());
+        }
+        fprintf(fp, "], \"archive\": [");
+        for (int i = 0; i < in_flight->archive.size(); ++i) {
+            fprintf(fp, "%s%s", i ? ", " : "",
+                    json_string(in_flight->archive[i]).c_str());
+        }
+        fprintf(fp, "], \"stalled\": %d, \"restarts\": %d",
+                in_flight->stalled, in_flight->restarts);
+        if (!in_flight->best.empty()) {
+            fprintf(fp, ", \"best\": %s",
+                    json_string(in_flight->best).c_str());
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "}\n");
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+    if (rename(tmp.c_str(), file.c_str()) != 0) {
+        perror(file.c_str());
+        stats.failed = true;
+        return;
+    }
+    last_checkpoint = std::chrono::steady_clock::now();
+}
+
+// Called after each puzzle is printed to record_buffer.
+template <class G>
+void puzzle_written() {
+    output_writer.write(output, record_buffer.take());
+    ++written_since_sync;
+    if (checkpoint_due()) {
+        write_checkpoint<G>(nullptr);
+    } else if (written_since_sync >= generator_options.output_batch) {
+        sync_output();
+    }
+}
+
+// Restore the state saved by write_checkpoint(), and open --output_file
+// truncated to the puzzles written before the checkpoint.
+template <class G>
+bool load_checkpoint(const std::string& json) {
+    std::string value;
+    if (!json_object_value(json, "config", &value) ||
+        json_unquote(value) != checkpoint_config<G>()) {
+        fprintf(stderr, "Checkpoint is for a different configuration "
+                "than %s\n", checkpoint_config<G>().c_str());
+        return false;
+    }
+
+    std::string in_flight;
+    if (json_object_value(json, "in_flight", &in_flight)) {
+        auto& resume = resumed<G>;
+        resume.reset(new Resumed<G>);
+        resume->iteration = json_int(in_flight, "iteration");
+        if (json_object_value(in_flight, "selector", &value)) {
+            resume->selector = json_unquote(value);
+        }
+        std::vector<std::string> population;
+        if (!json_object_value(in_flight, "candidate", &value) ||
+            !resume->candidate.restore(json_unquote(value)) ||
+            !json_object_value(in_flight, "population", &value) ||
+            !json_array_values(value, &population)) {
+            return false;
+        }
+        for (const auto& saved : population) {
+            resume->population.push_back(resume->candidate);
+            if (!resume->population.back().restore(json_unquote(saved))) {
+                return false;
+            }
+        }
+        std::vector<std::string> archive;
+        if (json_object_value(in_flight, "archive", &value)) {
+            json_array_values(value, &archive);
+        }
+        for (const auto& saved : archive) {
+            resume->archive.push_back(resume->candidate);
+            if (!resume->archive.back().restore(json_unquote(saved))) {
+                return false;
+            }
+        }
+        resume->stalled = json_int(in_flight, "stalled");
+        resume->restarts = json_int(in_flight, "restarts");
+        if (json_object_value(in_flight, "best", &value)) {
+            resume->best.push_back(resume->candidate);
+            if (!resume->best.back().restore(json_unquote(value))) {
+                return false;
+            }
+        }
+    }
+
+    // After constructing the Games above, which use the RNG.
+    if (!json_object_value(json, "rng", &value) ||
+        !rng.restore(json_unquote(value))) {
+        return false;
+    }
+
+    std::string saved_stats;
+    json_object_value(json, "stats", &saved_stats);
+    stats.candidate_attempts = json_int(saved_stats, "candidate_attempts");
+    stats.candidates = json_int(saved_stats, "candidates");
+    std::string rejects;
+    json_object_value(saved_stats, "candidate_rejects", &rejects);
+    for (int i = 0; i < CANDIDATE_REJECT_COUNT; ++i) {
+        stats.candidate_rejects[i] =
+            json_int(rejects, candidate_reject_name(CandidateReject(i)));
+    }
+    stats.puzzles = json_int(saved_stats, "puzzles");
+    stats.wasted = json_int(saved_stats, "wasted");
+    stats.duplicates = json_int(saved_stats, "duplicates");
+    stats.candidate_failures = json_int(saved_stats, "candidate_failures");
+    stats.time_limited = json_int(saved_stats, "time_limited");
+    stats.optimize_iterations = json_int(saved_stats, "optimize_iterations");
+    stats.classify_cache_hits = json_int(saved_stats, "classify_cache_hits");
+    stats.classify_cache_misses =
+        json_int(saved_stats, "classify_cache_misses");
+    stats.shard_position = json_int(saved_stats, "shard_position");
+    stats.plateaus = json_int(saved_stats, "plateaus");
+    stats.plateau_diversity = json_int(saved_stats, "plateau_diversity");
+    stats.restarts = json_int(saved_stats, "restarts");
+    stats.early_stops = json_int(saved_stats, "early_stops");
+    stats.wasted_mutations = json_int(saved_stats, "wasted_mutations");
+    auto restore_ints = [&] (const char* key, std::vector<int>* ints) {
+        std::vector<std::string> values;
+        if (json_object_value(saved_stats, key, &value)) {
+            json_array_values(value, &values);
+        }
+        ints->clear();
+        for (const auto& v : values) {
+            ints->push_back(atoi(v.c_str()));
+        }
+    };
+    restore_ints("puzzle_iterations", &stats.puzzle_iterations);
+    restore_ints("puzzle_scores", &stats.puzzle_scores);
+    std::string mutations;
+    json_object_value(saved_stats, "mutations", &mutations);
+    for (int op = 0; op < MUTATION_OP_COUNT; ++op) {
+        std::string counts;
+        json_object_value(mutations, mutation_op_name(MutationOp(op)),
+                          &counts);
+        stats.mutations[op].used = json_int(counts, "used");
+        stats.mutations[op].accepted = json_int(counts, "accepted");
+        stats.mutations[op].improved = json_int(counts, "improved");
+    }
+    std::vector<std::string> quotas;
+    if (json_object_value(saved_stats, "quotas", &value)) {
+        json_array_values(value, &quotas);
+    }
+    if (quotas.size() != stats.quotas.size()) {
+        fprintf(stderr, "Checkpoint has different --quotas\n");
+        return false;
+    }
+    for (int i = 0; i < quotas.size(); ++i) {
+        stats.quotas[i].add(json_int(quotas[i], "filled"));
+    }
+
+    output = fopen(generator_options.output_file.c_str(), "r+");
+    if (!output ||
+        ftruncate(fileno(output), json_int(json, "output_offset")) != 0 ||
+        fseek(output, 0, SEEK_END) != 0) {
+        perror(generator_options.output_file.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Classify the game by solving it in place, using only the given
+// rules. With a trail attached to the game, the solve can be undone
+// afterwards with rollback().
+template <class G>
+Classification classify_game_in_place(G* game,
+                                      FILE* print_progress=NULL,
+                                      unsigned rules=ALL_RULES) {
+    PerfScope perf(PERF_CLASSIFY);
+    Classification ret;
+
+    game->reset_hints();
+    const char* extra_json = "";
+
+    for (int i = 0; ; ++i) {
+        if (print_progress) {
+            game->print_json(print_progress, extra_json);
+        }
+
+        auto res = game->iterate(rules);
+        switch (res.first) {
+        case DeductionKind::NONE:
+            return ret;
+        case DeductionKind::COVER:
+            extra_json = "\"type\":\"cover\",";
+            ret.cover.depth++;
+            ret.cover.max_width = std::max(ret.cover.max_width,
+                                           res.second);
+            break;
+        case DeductionKind::CANT_FIT:
+            extra_json = "\"type\":\"fit\",";
+            ret.cant_fit.depth++;
+            ret.cant_fit.max_width = std::max(ret.cant_fit.max_width,
+                                              res.second);
+            break;
+        case DeductionKind::SQUARE:
+            extra_json = "\"type\":\"square\",";
+            ret.square.depth++;
+            ret.square.max_width = std::max(ret.square.max_width,
+                                            res.second);
+            break;
+        case DeductionKind::DEPENDENCY:
+            extra_json = "\"type\":\"dep\",";
+            ret.dep.depth++;
+            ret.dep.max_width = std::max(ret.dep.max_width,
+                                         res.second);
+            break;
+        case DeductionKind::ONE_OF:
+            extra_json = "\"type\":\"oneof\",";
+            ret.one_of.depth++;
+            ret.one_of.max_width = std::max(ret.one_of.max_width,
+                                           res.second);
+            break;
+        case DeductionKind::SINGLE_SOLUTION:
+            extra_json = "\"type\":\"single-solution\",";
+            ret.single_solution.depth++;
+            ret.single_solution.max_width =
+                std::max(ret.single_solution.max_width,
+                         res.second);
+            break;
+        case DeductionKind::UNCONTESTED_NO_COVER:
+            extra_json = "\"type\":\"uncontested-no-cover\",";
+            ret.uncontested_no_cover.depth++;
+            ret.uncontested_no_cover.max_width =
+                std::max(ret.uncontested_no_cover.max_width,
+                         res.second);
+            break;
+        }
+        ret.all.depth++;
+        ret.all.max_width = std::max(ret.all.max_width,
+                                     res.second);
+
+        if (game->solved()) {
+            if (print_progress) {
+                game->print_json(print_progress, extra_json);
+            }
+            ret.solved = true;
+            break;
+        }
+
+        if (game->impossible()) {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+// Classify a copy of the game, with the rules that the generator
+// options leave in.
+template <class G>
+Classification classify_game(G game,
+                             FILE* print_progress=NULL) {
+    return classify_game_in_place(&game, print_progress,
+                                  active_rules(generator_options));
+}
+
+// Apply one to three mutation operators picked by selector, and return
+// the ones that changed the game in ops, which is left empty if none
+// did. If any of them changed the hints, the dots are cleared to be
+// placed again from scratch for the new hints, and dot moves in the
+// same chain don't count since they're undone.
+template <class G>
+G mutate(G game, const MutationSelector& selector,
+         std::vector<MutationOp>* ops) {
+    MutationOp op = selector.adaptive() ? selector.pick() : MUTATE_SHRINK;
+    ops->clear();
+    while (true) {
+        int piece = rng() % G::N;
+        if (!selector.adaptive()) {
+            op = MutationOp(rng() % 3);
+        }
+        if (game.mutate(op, piece)) {
+            ops->push_back(op);
+        }
+        if (rng() % 3 >= 1) {
+            break;
+        }
+        if (selector.adaptive()) {
+            op = selector.pick();
+        }
+    }
+    auto dot_move = [] (MutationOp op) { return op == MUTATE_MOVE_DOT; };
+    if (!std::all_of(ops->begin(), ops->end(), dot_move)) {
+        game.reset_forced();
+        ops->erase(std::remove_if(ops->begin(), ops->end(), dot_move),
+                   ops->end());
+    }
+    game.finish_mutation();
+
+    return game;
+}
+
+// The optimizer's score for a classification with the --score_*
+// weights, before any quota steering.
+int weighted_score(const Classification& cls,
+                   const GeneratorOptions& options);
+
+// The classification components as objectives to maximize, for
+// ParetoArchive. Components with a negative --score_* default count
+// negatively.
+const int kParetoObjectives = 8;
+void pareto_objectives(const Classification& cls, int16_t* objectives);
+
+// A bounded archive of the solvable puzzles seen by one
+// minimize_width() call that no other one beats in every
+// classification component, so that puzzles can be selected for new
+// weightings without searching again. As long as there's no epsilon
+// and the archive hasn't filled up, the best puzzle seen for any
+// weighting of the components with the default signs is in it.
+//
+// With an epsilon above 1, objectives are compared in boxes of that
+// size (epsilon-dominance), and each box holds at most one puzzle,
+// which keeps the archive small but drops puzzles that no other one
+// dominates. Once the archive is full, a new puzzle only gets in by
+// dominating an existing one, so the archive is then only a sample of
+// the Pareto front.
+template <class G>
+class ParetoArchive {
+public:
+    ParetoArchive(int capacity, int epsilon)
+        : capacity_(capacity), epsilon_(std::max(1, epsilon)) {
+    }
+
+    bool enabled() const {
+        return capacity_ > 0;
+    }
+
+    int size() const {
+        return games_.size();
+    }
+
+    const G& game(int i) const {
+        return games_[i];
+    }
+
+    const Classification& cls(int i) const {
+        return classifications_[i];
+    }
+
+    void clear() {
+        objectives_.clear();
+        games_.clear();
+        classifications_.clear();
+    }
+
+    // Add a solvable puzzle, unless it is dominated. Returns true if it
+    // was added.
+    bool offer(const G& game, const Classification& cls) {
+        int16_t objectives[kParetoObjectives];
+        pareto_objectives(cls, objectives);
+
+        for (int i = 0; i < size(); ) {
+            const int16_t* other = &objectives_[i * kParetoObjectives];
+            bool better = false, worse = false, same_box = true;
+            for (int k = 0; k < kParetoObjectives; ++k) {
+                int box = floor_div(objectives[k]);
+                int other_box = floor_div(other[k]);
+                better = better || box > other_box;
+                worse = worse || box < other_box;
+                same_box = same_box && box == other_box;
+            }
+            if (same_box) {
+                // Keep the existing one unless the new one dominates
+                // it outright.
+                better = false;
+                worse = false;
+                for (int k = 0; k < kParetoObjectives; ++k) {
+                    better = better || objectives[k] > other[k];
+                    worse = worse || objectives[k] < other[k];
+                }
+                if (!better || worse) {
+                    return false;
+                }
+            } else if (worse && !better) {
+                return false;
+            }
+            if (better && !worse) {
+                remove(i);
+            } else {
+                ++i;
+            }
+        }
+        if (size() >= capacity_) {
+            return false;
+        }
+
+        objectives_.insert(objectives_.end(), objectives,
+                           objectives + kParetoObjectives);
+        games_.push_back(game);
+        classifications_.push_back(cls);
+        return true;
+    }
+
+private:
+    int floor_div(int value) const {
+        return value >= 0 ? value / epsilon_ :
+            -((-value + epsilon_ - 1) / epsilon_);
+    }
+
+    void remove(int i) {
+        int last = size() - 1;
+        std::copy(&objectives_[last * kParetoObjectives],
+                  &objectives_[(last + 1) * kParetoObjectives],
+                  &objectives_[i * kParetoObjectives]);
+        objectives_.resize(last * kParetoObjectives);
+        games_[i] = games_[last];
+        games_.pop_back();
+        classifications_[i] = classifications_[last];
+        classifications_.pop_back();
+    }
+
+    int capacity_;
+    int epsilon_;
+    // The objectives of all members back to back, so that the
+    // dominance checks scan one contiguous array.
+    std::vector<int16_t> objectives_;
+    std::vector<G> games_;
+    std::vector<Classification> classifications_;
+};
+
+template <class G>
+struct OptimizationResult {
+    OptimizationResult(G game, Classification cls,
+                       const Quota* target = nullptr,
+                       const ScoreFormula* formula = nullptr)
+        : game(game), cls(cls) {
+        const GeneratorOptions& options = generator_options;
+        score = weighted_score(cls, options);
+        // Steer the optimizer towards puzzles the targeted quota
+        // still needs.
+        if (target) {
+            score += options.quota_steer_weight *
+                target->filter().matches(cls, formula->score(cls));
+        }
+    }
+
+    G game;
+    Classification cls;
+    int score;
+};
+
+template <class G>
+std::optional<G> create_candidate_game(int* attempts = nullptr);
+
+// The number of distinct puzzles in an optimizer population.
+template <class G>
+int population_diversity(const std::vector<OptimizationResult<G>>& res) {
+    std::vector<std::vector<std::string>> puzzles;
+    for (const auto& member : res) {
+        puzzles.push_back(member.game.puzzle_rows());
+    }
+    std::sort(puzzles.begin(), puzzles.end());
+    return std::unique(puzzles.begin(), puzzles.end()) - puzzles.begin();
+}
+
+// Optimize the game for the --score_* weights. With an archive, also
+// collect the Pareto-optimal puzzles found along the way in it.
+//
+// With --plateau_iterations, the search counts as stuck once the best
+// score hasn't improved for that many iterations. It then starts over
+// from a new candidate, up to --plateau_restarts times, and otherwise
+// stops early. The best game of all the restarts is returned.
+template <class G>
+G minimize_width(G game,
+                 const Quota* target = nullptr,
+                 const ScoreFormula* formula = nullptr,
+                 ParetoArchive<G>* archive = nullptr) {
+    PerfScope perf(PERF_OPTIMIZER);
+    const GeneratorOptions& options = generator_options;
+    const int N = options.optimize_iterations;
+    if (archive) {
+        archive->clear();
+    }
+    if (!N) {
+        // The per-puzzle stats still get an entry for this puzzle.
+        OptimizationResult<G> unchanged(game, classify_game(game), target,
+                                        formula);
+        stats.puzzle_iterations.push_back(0);
+        stats.puzzle_scores.push_back(unchanged.score);
+        return game;
+    }
+
+    struct Cmp {
+        bool operator() (const OptimizationResult<G>& a,
+                         const OptimizationResult<G>& b) {
+            return b.score < a.score;
+        }
+    };
+
+    FILE* fp = nullptr;
+    if (!options.solve_progress_file.empty()) {
+        fp = fopen(options.solve_progress_file.c_str(), "w");
+    }
+
+    std::vector<OptimizationResult<G>> res;
+    // The best result from before the last restart.
+    std::vector<OptimizationResult<G>> best;
+    int start = 0;
+    int stalled = 0;
+    int restarts = 0;
+    MutationSelector selector(options.adaptive_mutation);
+    std::vector<MutationOp> ops;
+    // The classification of recent mutants, by puzzle. About a quarter
+    // of the mutants turn out to be a puzzle that was already tried,
+    // and classifying is a pure function of the puzzle. Nearly all the
+    // repeats are of recent mutants, so a small cache that is dropped
+    // when it fills up catches them as well as a large one.
+    std::unordered_map<std::string, Classification> classified;
+    const int max_classified = 4096;
+    auto classify_mutant = [&] (const G& mutant) {
+        std::string key = mutant.puzzle_key();
+        auto it = classified.find(key);
+        if (it != classified.end()) {
+            ++stats.classify_cache_hits;
+            return it->second;
+        }
+        if (classified.size() >= max_classified) {
+            classified.clear();
+        }
+        ++stats.classify_cache_misses;
+        Classification cls = classify_game(mutant);
+        classified.emplace(std::move(key), cls);
+        return cls;
+    };
+
+    char buf[256];
+    auto extra_json = [&] (int iter, int score) {
+        sprintf(buf, "\"score\":%d,\"iter\":%d,", score, iter);
+        return buf;
+    };
+    auto& resume = resumed<G>;
+    if (resume) {
+        for (const auto& member : resume->population) {
+            res.emplace_back(member, classify_game(member), target, formula);
+        }
+        start = resume->iteration;
+        if (!resume->selector.empty()) {
+            selector.restore(resume->selector);
+        }
+        if (archive) {
+            for (const auto& member : resume->archive) {
+                archive->offer(member, classify_game(member));
+            }
+        }
+        stalled = resume->stalled;
+        restarts = resume->restarts;
+        for (const auto& member : resume->best) {
+            best.emplace_back(member, classify_game(member), target, formula);
+        }
+        resume.reset();
+    } else {
+        res.emplace_back(game, classify_game(game), target, formula);
+        if (fp) {
+            game.print_json(fp, extra_json(0, res[0].score));
+        }
+        if (archive) {
+            archive->offer(game, res[0].cls);
+        }
+    }
+
+    auto optimize_start = std::chrono::steady_clock::now();
+    int i = start;
+    for (; i < N; ++i) {
+        // Anytime result: settle for the best so far.
+        if (puzzle_deadline.passed()) {
+            ++stats.time_limited;
+            break;
+        }
+        ++stats.optimize_iterations;
+        if (checkpoint_due()) {
+            InFlight in_flight { game.save(), i };
+            in_flight.selector = selector.save();
+            for (int j = 0; archive && j < archive->size(); ++j) {
+                in_flight.archive.push_back(archive->game(j).save());
+            }
+            for (const auto& member : res) {
+                in_flight.population.push_back(member.game.save());
+            }
+            in_flight.stalled = stalled;
+            in_flight.restarts = restarts;
+            if (!best.empty()) {
+                in_flight.best = best[0].game.save();
+            }
+            write_checkpoint<G>(&in_flight);
+        }
+
+        if (options.plateau_iterations > 0 &&
+            stalled >= options.plateau_iterations) {
+            ++stats.plateaus;
+            stats.plateau_diversity += population_diversity(res);
+            std::optional<G> fresh;
+            if (restarts < options.plateau_restarts) {
+                fresh = create_candidate_game<G>();
+            }
+            if (!fresh) {
+                ++stats.early_stops;
+                break;
+            }
+            ++stats.restarts;
+            ++restarts;
+            stalled = 0;
+            if (best.empty() || res[0].score > best[0].score) {
+                best.assign(1, res[0]);
+            }
+            res.clear();
+            res.emplace_back(*fresh, classify_game(*fresh), target, formula);
+            if (archive) {
+                archive->offer(*fresh, res[0].cls);
+            }
+        }
+
+        auto base = res[rng() % res.size()];
+        G opt = mutate(base.game, selector, &ops);
+        if (ops.empty()) {
+            ++stats.wasted_mutations;
+            ++stalled;
+            continue;
+        }
+        opt = add_forced_squares(opt, NULL);
+        OptimizationResult<G> opt_res(opt, classify_mutant(opt), target,
+                                      formula);
+
+        bool solved = opt_res.cls.solved;
+        bool improved = solved && opt_res.score > res[0].score;
+        for (MutationOp op : ops) {
+            auto& counts = stats.mutations[op];
+            ++counts.used;
+            counts.accepted += solved;
+            counts.improved += improved;
+        }
+        selector.reward(ops, solved, improved);
+        if (solved && archive) {
+            archive->offer(opt, opt_res.cls);
+        }
+
+        stalled = improved ? 0 : stalled + 1;
+        if (solved) {
+            // if (opt_res.score > res[0].score) {
+            //     fprintf(stderr, "%d: %d\n", i, res[0].score);
+            // }
+            res.push_back(opt_res);
+            if (fp &&
+                opt_res.score > res[0].score) {
+                opt.print_json(fp, extra_json(i, res[0].score));
+            }
+            sort(res.begin(), res.end(), Cmp());
+            if (res.size() > 10) {
+                res.pop_back();
+            }
+        }
+    }
+    // fprintf(stderr, "---\n");
+    stats.optimize_ms += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - optimize_start).count();
+
+    if (!best.empty() && best[0].score >= res[0].score) {
+        res[0] = best[0];
+    }
+    stats.puzzle_iterations.push_back(i);
+    stats.puzzle_scores.push_back(res[0].score);
+    return res[0].game;
+}
+
+template <class G>
+G optimize_game(G game,
+                 const Quota* target = nullptr,
+                 const ScoreFormula* formula = nullptr,
+                 ParetoArchive<G>* archive = nullptr) {
+    Classification cls = classify_game(game);
+
+    G opt = minimize_width(game, target, formula, archive);
+    Classification opt_cls = classify_game(opt);
+
+    char progress[256];
+    snprintf(progress, sizeof(progress),
+             "%d/%d [%d/%d/%d/%d/%d/%d/%d] -> %d/%d "
+             "[%d/%d/%d/%d/%d/%d/%d]\n",
+             cls.all.max_width,
+             cls.all.depth,
+             cls.one_of.depth,
+             cls.dep.depth,
+             cls.square.depth,
+             cls.cant_fit.depth,
+             cls.cover.depth,
+             cls.single_solution.depth,
+             cls.uncontested_no_cover.depth,
+             opt_cls.all.max_width,
+             opt_cls.all.depth,
+             opt_cls.one_of.depth,
+             opt_cls.dep.depth,
+             opt_cls.square.depth,
+             opt_cls.cant_fit.depth,
+             opt_cls.cover.depth,
+             opt_cls.single_solution.depth,
+             opt_cls.uncontested_no_cover.depth);
+    output_writer.write(stderr, progress);
+
+    return opt;
+}
+
+
+// Whether the candidate search wants puzzles that need the square,
+// dep or one-of rules, of those that are in use.
+inline bool needs_interaction(const GeneratorOptions& options) {
+    unsigned rules = active_rules(options);
+    return (options.score_square > 0 && (rules & RULE_SQUARE)) ||
+        (options.score_dep > 0 && (rules & RULE_DEPENDENCY)) ||
+        (options.score_one_of > 0 && (rules & RULE_ONE_OF));
+}
+
+// The cheap checks of --fast_reject, on a random game before any dots
+// are placed. Returns the first check it fails, or
+// CANDIDATE_REJECT_COUNT if it passes them all. Only the overlap
+// check with --fast_reject_min_overlap can reject a game that could
+// have become a candidate; the square, dep and one-of rules all need
+// a square that two pieces could cover.
+template <class G>
+CandidateReject fast_reject(const G& game) {
+    const GeneratorOptions& options = generator_options;
+    for (int piece = 0; piece < G::N; ++piece) {
+        if (!game.valid_orientations(piece)) {
+            return REJECT_ORIENTATION;
+        }
+    }
+
+    int min_overlap = options.fast_reject_min_overlap;
+    if (needs_interaction(options)) {
+        min_overlap = std::max(min_overlap, 1);
+    }
+    if (min_overlap > 0) {
+        const typename G::CountArray counts = game.orig_possible_counts();
+        int overlap = std::count_if(counts.begin(), counts.end(),
+                                    [] (int count) { return count >= 2; });
+        if (overlap < min_overlap) {
+            return REJECT_OVERLAP;
+        }
+    }
+
+    // Every piece has to cover the squares that all its orientations
+    // do, so no other piece can use an orientation that covers one of
+    // them. Drop those until nothing changes; a piece left with no
+    // orientations means the pieces can't all be placed. This catches
+    // about as many boards as a search for a placement, at a fraction
+    // of the cost.
+    using SquareSet = typename G::SquareSet;
+    std::array<std::array<SquareSet, 16>, G::N> squares;
+    std::array<uint16_t, G::N> valid;
+    for (int piece = 0; piece < G::N; ++piece) {
+        valid[piece] = game.valid_orientations(piece);
+        for (int o = 0; valid[piece] >> o; ++o) {
+            if (valid[piece] & (1 << o)) {
+                squares[piece][o] = game.orientation_squares(piece, o);
+            }
+        }
+    }
+    for (bool changed = true; changed; ) {
+        changed = false;
+        std::array<SquareSet, G::N> must;
+        for (int piece = 0; piece < G::N; ++piece) {
+            must[piece].set();
+            for (int o = 0; valid[piece] >> o; ++o) {
+                if (valid[piece] & (1 << o)) {
+                    must[piece] &= squares[piece][o];
+                }
+            }
+        }
+        for (int piece = 0; piece < G::N; ++piece) {
+            SquareSet taken;
+            for (int other = 0; other < G::N; ++other) {
+                if (other != piece) {
+                    taken |= must[other];
+                }
+            }
+            for (int o = 0; valid[piece] >> o; ++o) {
+                if ((valid[piece] & (1 << o)) &&
+                    (squares[piece][o] & taken).any()) {
+                    valid[piece] &= ~(1 << o);
+                    changed = true;
+                }
+            }
+            if (!valid[piece]) {
+                return REJECT_FIT;
+            }
+        }
+    }
+    return CANDIDATE_REJECT_COUNT;
+}
+
+// Find a game with the given parameters that can be solved. Gives up
+// after --max_candidate_attempts, or when the puzzle's time budget
+// runs out. If attempts isn't null, the attempts are counted there,
+// and those that were already counted are taken off the limit, so
+// that several searches can share it.
+template <class G>
+std::optional<G> create_candidate_game(int* attempts) {
+    PerfScope perf(PERF_CANDIDATE);
+    const GeneratorOptions& options = generator_options;
+    auto start = std::chrono::steady_clock::now();
+    auto done = [&start] () {
+        stats.candidate_ms += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    };
+
+    int search_attempts = 0;
+    if (!attempts) {
+        attempts = &search_attempts;
+    }
+    while (*attempts < options.max_candidate_attempts) {
+        if (puzzle_deadline.passed()) {
+            break;
+        }
+        ++*attempts;
+
+        G game = options.constructive ? G(typename G::Layout()) : G();
+        if (options.fast_reject) {
+            CandidateReject reject = fast_reject(game);
+            if (reject != CANDIDATE_REJECT_COUNT) {
+                ++stats.candidate_rejects[reject];
+                continue;
+            }
+        }
+
+        FILE* fp = nullptr;
+        if (!options.candidate_progress_file.empty()) {
+            fp = fopen(options.candidate_progress_file.c_str(), "w");
+        }
+        game = add_forced_squares(game, fp);
+        ++stats.candidate_attempts;
+        if (fp)
+            fclose(fp);
+
+        if (!game.solved()) {
+            ++stats.candidate_rejects[REJECT_UNSOLVED];
+            continue;
+        }
+        Classification cls = classify_game(game);
+        if (!cls.solved) {
+            ++stats.candidate_rejects[REJECT_UNCLASSIFIED];
+            continue;
+        }
+        if (needs_interaction(options) &&
+            (cls.square.depth == 0 &&
+             cls.one_of.depth == 0 &&
+             cls.dep.depth == 0)) {
+            ++stats.candidate_rejects[REJECT_TRIVIAL];
+            continue;
+        }
+        ++stats.candidates;
+        done();
+        return game;
+    }
+
+    ++stats.candidate_failures;
+    done();
+    return std::nullopt;
+}
+
+// Start from a new candidate, or from the one that was being optimized
+// when the checkpoint was taken. Candidate searches that run out of
+// time are retried with a new budget, up to --max_candidate_retries
+// times, and the retries share --max_candidate_attempts, so that the
+// time and attempts spent on one puzzle are bounded. Returns nothing
+// if the run should stop, either because it's out of time or because
+// the search gave up, which retrying won't help.
+template <class G>
+std::optional<G> next_candidate_game() {
+    if (resumed<G>) {
+        return resumed<G>->candidate;
+    }
+    const GeneratorOptions& options = generator_options;
+    int attempts = 0;
+    for (int retries = 0; ; ++retries) {
+        auto game = create_candidate_game<G>(&attempts);
+        if (game) {
+            return game;
+        }
+        if (!start_puzzle()) {
+            return std::nullopt;
+        }
+        if (attempts >= options.max_candidate_attempts ||
+            retries >= options.max_candidate_retries) {
+            fprintf(stderr, "No solvable candidate found in %d attempts "
+                    "and %d retries\n", attempts, retries);
+            stats.gave_up = true;
+            return std::nullopt;
+        }
+    }
+}
+
+// Print a puzzledb record. With a non-empty archive, the record also
+// has the archived puzzles, in the same format, for
+// --select_from_archive.
+template <class G>
+void print_puzzle_record(const G& game, const Classification& cls,
+                         const std::string& extra_json = "",
+                         FILE* fp = stdout,
+                         const ParetoArchive<G>* archive = nullptr) {
+    fprintf(fp, "{ \"puzzle\": [");
+    game.print_puzzle(true, fp);
+    cls.print("], \"classification\": {", "}", fp);
+    if (archive && archive->size()) {
+        fprintf(fp, ", \"archive\": [");
+        for (int i = 0; i < archive->size(); ++i) {
+            fprintf(fp, "%s{ \"puzzle\": [", i ? ", " : "");
+            archive->game(i).print_puzzle(true, fp);
+            archive->cls(i).print("], \"classification\": {", "}}", fp);
+        }
+        fprintf(fp, "]");
+    }
+    fprintf(fp, "%s}\n", extra_json.c_str());
+}
+
+// Generate puzzles until every quota in --quotas is full. Each puzzle
+// is optimized towards the least full quota, and kept only if some
+// open quota accepts it. Gives up after --quota_max_misses puzzles in a
+// row that weren't kept, since some open quota is then likely to be
+// unsatisfiable.
+template <class G>
+void generate_for_quotas() {
+    const GeneratorOptions& options = generator_options;
+    auto& quotas = stats.quotas;
+    // Already checked by reset_generator().
+    ScoreFormula formula;
+    ScoreFormula::parse(options.collection_score, &formula);
+    ParetoArchive<G> archive(options.pareto_archive,
+                             options.archive_epsilon);
+    ParetoArchive<G>* keep = archive.enabled() ? &archive : nullptr;
+    int misses = 0;
+
+    while (!options.quota_max_puzzles ||
+           stats.puzzles < options.quota_max_puzzles) {
+        if (options.quota_max_misses && misses >= options.quota_max_misses) {
+            fprintf(stderr, "No quota accepted the last %d puzzles, "
+                    "giving up\n", misses);
+            stats.gave_up = true;
+            break;
+        }
+        Quota* target = nullptr;
+        for (auto& quota : quotas) {
+            if (!quota.full() &&
+                (!target || quota.fill_ratio() < target->fill_ratio())) {
+                target = &quota;
+            }
+        }
+        if (!target) {
+            break;
+        }
+
+        if (!start_puzzle()) {
+            break;
+        }
+        auto game = next_candidate_game<G>();
+        if (!game) {
+            break;
+        }
+        G opt = optimize_game(*game, target, &formula, keep);
+        Classification cls = classify_game(opt);
+        double score = formula.score(cls);
+        ++stats.puzzles;
+        ++misses;
+
+        int accepted = -1;
+        for (int i = 0; i < quotas.size(); ++i) {
+            if (!quotas[i].full() &&
+                quotas[i].filter().accepts(cls, score)) {
+                accepted = i;
+                break;
+            }
+        }
+        if (accepted < 0) {
+            ++stats.wasted;
+            continue;
+        }
+        // Only puzzles that are written count as seen, so that the
+        // seen set can be rebuilt from the output on --resume.
+        if (!is_new_puzzle(opt)) {
+            continue;
+        }
+        quotas[accepted].add();
+        misses = 0;
+
+        char extra_json[64];
+        snprintf(extra_json, sizeof(extra_json),
+                 ", \"quota\": %d, \"score\": %g", accepted, score);
+        print_puzzle_record(opt, cls, extra_json, record_buffer.fp(), keep);
+        puzzle_written<G>();
+    }
+}
+
+// Generate --puzzle_count puzzles, counting those written before a
+// checkpoint.
+template <class G>
+void generate_for_count() {
+    const GeneratorOptions& options = generator_options;
+    ParetoArchive<G> archive(options.pareto_archive,
+                             options.archive_epsilon);
+    ParetoArchive<G>* keep = archive.enabled() ? &archive : nullptr;
+    for (int j = stats.puzzles - stats.duplicates;
+         j < options.puzzle_count; ) {
+        if (!start_puzzle()) {
+            break;
+        }
+        auto game = next_candidate_game<G>();
+        if (!game) {
+            break;
+        }
+        G opt = optimize_game(*game, nullptr, nullptr, keep);
+        Classification cls = classify_game(opt);
+        ++stats.puzzles;
+        if (!is_new_puzzle(opt)) {
+            continue;
+        }
+
+        print_puzzle_record(opt, cls, "", record_buffer.fp(), keep);
+        puzzle_written<G>();
+        ++j;
+    }
+}
+
+// Generate this shard's share of --puzzle_count puzzle indices. The
+// RNG is seeded from --seed and the index for each puzzle, so a puzzle
+// comes out the same whatever the sharding, and each record has its
+// index for --merge_shards.
+template <class G>
+void generate_for_shard() {
+    const GeneratorOptions& options = generator_options;
+    ParetoArchive<G> archive(options.pareto_archive,
+                             options.archive_epsilon);
+    ParetoArchive<G>* keep = archive.enabled() ? &archive : nullptr;
+    while (true) {
+        int64_t index = options.shard_index +
+            stats.shard_position * options.shard_count;
+        if (index >= options.puzzle_count || !start_puzzle()) {
+            break;
+        }
+        // A resumed puzzle continues with the RNG from the checkpoint.
+        if (!resumed<G>) {
+            rng.reseed(puzzle_seed(options.seed, index));
+        }
+        auto game = next_candidate_game<G>();
+        if (!game) {
+            break;
+        }
+        G opt = optimize_game(*game, nullptr, nullptr, keep);
+        Classification cls = classify_game(opt);
+        ++stats.puzzles;
+        ++stats.shard_position;
+        if (!is_new_puzzle(opt)) {
+            continue;
+        }
+
+        char extra_json[64];
+        snprintf(extra_json, sizeof(extra_json), ", \"index\": %ld", index);
+        print_puzzle_record(opt, cls, extra_json, record_buffer.fp(), keep);
+        puzzle_written<G>();
+    }
+}
+
+// A puzzle on its way through generate_pipelined().
+template <class G>
+struct PipelineItem {
+    explicit PipelineItem(const GeneratorOptions& options)
+        : archive(options.pareto_archive, options.archive_epsilon) {
+    }
+
+    int64_t index = 0;
+    // The run stops before this puzzle: the candidate search gave up,
+    // or the run is out of time or was interrupted.
+    bool stop = false;
+    Deadline deadline;
+    std::string rng;
+    std::optional<G> game;
+    ParetoArchive<G> archive;
+    int iterations = 0;
+    int score = 0;
+    std::string record;
+};
+
+// Generate the same puzzles as generate_for_shard(), but with the
+// candidate search, the optimizer and the final classification and
+// formatting each on their own threads, so that a stage that stalls,
+// like the candidate search with --score_square, doesn't leave the
+// cores of the others idle. The stages pass puzzles along through
+// bounded queues, and the calling thread writes them in index order.
+template <class G>
+void generate_pipelined() {
+    using Clock = std::chrono::steady_clock;
+    using Item = std::unique_ptr<PipelineItem<G>>;
+    const GeneratorOptions options = generator_options;
+    const Deadline deadline = run_deadline;
+    const int step = std::max(1, options.shard_count);
+    std::array<int, 3> threads = {
+        std::max(1, options.pipeline_candidate_threads),
+        std::max(1, options.pipeline_optimize_threads),
+        std::max(1, options.pipeline_finish_threads),
+    };
+    std::array<BoundedQueue<Item>, 3> queues = {
+        BoundedQueue<Item>(options.pipeline_queue),
+        BoundedQueue<Item>(options.pipeline_queue),
+        BoundedQueue<Item>(options.pipeline_queue),
+    };
+    std::atomic<int64_t> next_position(stats.shard_position);
+    std::atomic<bool> stop(false);
+
+    std::mutex mutex;
+    GenerationStats worker_stats;
+    std::array<int, 3> running = threads;
+    auto start = Clock::now();
+
+    // The candidate threads don't start a puzzle more than window
+    // positions past the first one that hasn't been written, so that
+    // the finished puzzles held back behind one that stalls are no
+    // more than what fits in the queues and threads.
+    const int64_t window = 3 * options.pipeline_queue +
+        threads[0] + threads[1] + threads[2];
+    int64_t written_position = stats.shard_position;
+    std::condition_variable written;
+
+    // Run a stage on a worker thread with the generator state of the
+    // run, until it's out of work. The last thread of a stage closes
+    // its output queue.
+    auto run_stage = [&] (int stage, auto work) {
+        generator_options = options;
+        run_deadline = deadline;
+        double busy_ms = 0;
+        work([&busy_ms] (auto fn) {
+                auto begin = Clock::now();
+                fn();
+                busy_ms += std::chrono::duration<double, std::milli>(
+                    Clock::now() - begin).count();
+            });
+        std::lock_guard<std::mutex> lock(mutex);
+        worker_stats.add(stats);
+        worker_stats.pipeline[stage].busy_ms += busy_ms;
+        if (--running[stage] == 0) {
+            queues[stage].close();
+        }
+    };
+
+    auto candidate_stage = [&] (auto timed) {
+        while (!stop) {
+            Item item(new PipelineItem<G>(options));
+            int64_t position = next_position++;
+            item->index = options.shard_index + position * step;
+            if (item->index >= options.puzzle_count) {
+                break;
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                written.wait(lock, [&] {
+                        return stop || position < written_position + window;
+                    });
+            }
+            if (stop) {
+                break;
+            }
+            timed([&] () {
+                    if (!start_puzzle()) {
+                        item->stop = true;
+                        return;
+                    }
+                    item->deadline = puzzle_deadline;
+                    rng.reseed(puzzle_seed(options.seed, item->index));
+                    item->game = next_candidate_game<G>();
+                    item->stop = !item->game;
+                    item->rng = rng.save();
+                });
+            bool last = item->stop;
+            queues[0].push(std::move(item));
+            if (last) {
+                break;
+            }
+        }
+    };
+
+    auto optimize_stage = [&] (auto timed) {
+        Item item;
+        while (queues[0].pop(&item)) {
+            if (!item->stop && !stop) {
+                timed([&] () {
+                        rng.restore(item->rng);
+                        puzzle_deadline = item->deadline;
+                        ParetoArchive<G>* keep = item->archive.enabled() ?
+                            &item->archive : nullptr;
+                        item->game = optimize_game(*item->game, nullptr,
+                                                   nullptr, keep);
+                        // Written in index order by the calling thread.
+                        item->iterations = stats.puzzle_iterations.back();
+                        item->score = stats.puzzle_scores.back();
+                        stats.puzzle_iterations.pop_back();
+                        stats.puzzle_scores.pop_back();
+                    });
+            }
+            queues[1].push(std::move(item));
+        }
+    };
+
+    auto finish_stage = [&] (auto timed) {
+        Item item;
+        while (queues[1].pop(&item)) {
+            if (!item->stop && !stop) {
+                timed([&] () {
+                        Classification cls = classify_game(*item->game);
+                        char extra_json[64];
+                        snprintf(extra_json, sizeof(extra_json),
+                                 ", \"index\": %ld", item->index);
+                        print_puzzle_record(*item->game, cls, extra_json,
+                                            record_buffer.fp(),
+                                            item->archive.enabled() ?
+                                            &item->archive : nullptr);
+                        item->record = record_buffer.take();
+                    });
+            }
+            queues[2].push(std::move(item));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads[0]; ++i) {
+        workers.emplace_back(run_stage, 0, candidate_stage);
+    }
+    for (int i = 0; i < threads[1]; ++i) {
+        workers.emplace_back(run_stage, 1, optimize_stage);
+    }
+    for (int i = 0; i < threads[2]; ++i) {
+        workers.emplace_back(run_stage, 2, finish_stage);
+    }
+
+    // Puzzles can finish out of order, so hold on to them until the
+    // ones before them are done.
+    std::map<int64_t, Item> done;
+    int64_t next_index = options.shard_index + stats.shard_position * step;
+    Item item;
+    while (queues[2].pop(&item)) {
+        done[item->index] = std::move(item);
+        while (!stop && !done.empty() && done.begin()->first == next_index) {
+            Item ready = std::move(done.begin()->second);
+            done.erase(done.begin());
+            if (ready->stop) {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+                written.notify_all();
+                break;
+            }
+            ++stats.puzzles;
+            ++stats.shard_position;
+            next_index += step;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                written_position = stats.shard_position;
+                written.notify_all();
+            }
+            stats.puzzle_iterations.push_back(ready->iterations);
+            stats.puzzle_scores.push_back(ready->score);
+            if (is_new_puzzle(*ready->game)) {
+                fputs(ready->record.c_str(), record_buffer.fp());
+                puzzle_written<G>();
+            }
+        }
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    double wall_ms = std::chrono::duration<double, std::milli>(
+        Clock::now() - start).count();
+    stats.add(worker_stats);
+    char summary[256];
+    int length = snprintf(summary, sizeof(summary), "pipeline occupancy:");
+    static const char* names[] = { "candidate", "optimize", "finish" };
+    for (int i = 0; i < 3; ++i) {
+        auto& stage = stats.pipeline[i];
+        stage.threads = threads[i];
+        stage.busy_ms = worker_stats.pipeline[i].busy_ms;
+        stage.wall_ms = wall_ms * threads[i];
+        stage.mean_queued = i ? queues[i - 1].mean_queued() : 0.0;
+        length += snprintf(summary + length, sizeof(summary) - length,
+                           " %s %.2f (%d threads, %.1f queued)", names[i],
+                           stage.occupancy(), stage.threads,
+                           stage.mean_queued);
+    }
+    snprintf(summary + length, sizeof(summary) - length, "\n");
+    output_writer.write(stderr, summary);
+}
+
+// Open --output_file, continuing from --checkpoint_file with --resume.
+template <class G>
+bool open_output() {
+    const GeneratorOptions& options = generator_options;
+    resumed<G>.reset();
+    if (options.resume && !options.checkpoint_file.empty() &&
+        access(options.checkpoint_file.c_str(), F_OK) == 0) {
+        std::string checkpoint;
+        if (!read_file(options.checkpoint_file, &checkpoint) ||
+            !load_checkpoint<G>(checkpoint)) {
+            fprintf(stderr, "Can't resume from %s\n",
+                    options.checkpoint_file.c_str());
+            return false;
+        }
+        // Puzzles written before the checkpoint have been seen.
+        if (options.dedup && !options.shard_count) {
+            load_puzzle_hashes(options.output_file, &seen_puzzles);
+        }
+        return true;
+    }
+
+    if (!options.output_file.empty()) {
+        output = fopen(options.output_file.c_str(), "w");
+        if (!output) {
+            perror(options.output_file.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Generate --puzzle_count puzzles, or until --quotas are full, into
+// the output opened by open_output().
+template <class G>
+void generate_puzzles() {
+    const GeneratorOptions& options = generator_options;
+    run_deadline = Deadline::after_ms(options.run_time_budget_ms);
+    if (options.perf_counters && !perf_counters.enabled()) {
+        perf_counters.start();
+    }
+
+    if (options.dedup && !options.dedup_against.empty()) {
+        load_puzzle_hashes(options.dedup_against, &seen_puzzles);
+    }
+
+    if (!options.quotas.empty()) {
+        generate_for_quotas<G>();
+    } else if (options.pipeline_optimize_threads) {
+        generate_pipelined<G>();
+    } else if (options.shard_count) {
+        generate_for_shard<G>();
+    } else {
+        generate_for_count<G>();
+    }
+    if (stats.interrupted && !options.checkpoint_file.empty()) {
+        write_checkpoint<G>(nullptr);
+    }
+}
+
+#endif // LINJAT_GENERATOR_H
@@ -0,0 +1,79 @@
+#ifndef LINJAT_GENERATOR_OPTIONS_H
+#define LINJAT_GENERATOR_OPTIONS_H
+
+#include <string>
+
+// Everything a generator run is configured with. main() fills this in
+// from the flags of the same names, and --manifest jobs override the
+// count, seed and scores.
+struct GeneratorOptions {
+    int seed = 1;
+    int puzzle_count = 100;
+    int optimize_iterations = 10000;
+    std::string solve_progress_file;
+    std::string candidate_progress_file;
+
+    int score_cover = 1;
+    int score_cant_fit = 1;
+    int score_square = 1;
+    int score_dep = 1;
+    int score_one_of = 1;
+    int score_max_width = -1;
+    int score_single_solution = -50;
+    int score_uncontested_no_cover = -1;
+
+    std::string quotas;
+    int quota_max_puzzles = 0;
+    // Give up once this many puzzles in a row went into no quota.
+    int quota_max_misses = 1000;
+    int quota_steer_weight = 100;
+    std::string collection_score;
+
+    bool dedup = true;
+    std::string dedup_against;
+    std::string output_file;
+    std::string checkpoint_file;
+    bool resume = false;
+    int checkpoint_interval_s = 60;
+    int output_batch = 10;
+
+    int time_budget_ms = 0;
+    int run_time_budget_ms = 0;
+    int max_candidate_attempts = 1000000;
+    // How many times the candidate search for one puzzle is started
+    // over with a new time budget after running out of time.
+    int max_candidate_retries = 10;
+    // Reject random games that can't make a candidate with cheap checks
+    // before placing any dots, and also those with fewer than
+    // fast_reject_min_overlap squares that two pieces could cover.
+    bool fast_reject = false;
+    int fast_reject_min_overlap = 0;
+    // Take the hints of candidates from a random layout of pieces,
+    // rather than placing them at random, see Game::construct().
+    bool constructive = false;
+    // The rules of Game::iterate() to leave out when placing dots and
+    // classifying, and whether to also leave out those with a zero
+    // --score_* weight. See parse_disabled_rules() in linjat.h.
+    unsigned disabled_rules = 0;
+    bool disable_unscored_rules = false;
+    bool perf_counters = false;
+    bool adaptive_mutation = false;
+    int pareto_archive = 0;
+    int archive_epsilon = 1;
+    int plateau_iterations = 0;
+    int plateau_restarts = 0;
+    // With shard_count > 0, generate only the puzzles with index
+    // shard_index modulo shard_count, each from its own RNG seed.
+    int shard_index = 0;
+    int shard_count = 0;
+    // With pipeline_optimize_threads > 0, generate each puzzle index
+    // from its own RNG seed, like a shard, in a pipeline of candidate,
+    // optimize and finish stages with these numbers of threads, and
+    // queues of pipeline_queue puzzles between them.
+    int pipeline_candidate_threads = 0;
+    int pipeline_optimize_threads = 0;
+    int pipeline_finish_threads = 0;
+    int pipeline_queue = 4;
+};
+
+#endif // LINJAT_GENERATOR_OPTIONS_H
@@ -0,0 +1,183 @@
+#ifndef LINJAT_HINT_H
+#define LINJAT_HINT_H
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "game.h"
+
+// The name of a deduction, as in the "type" of --solve_progress_file.
+inline const char* deduction_name(DeductionKind kind) {
+    switch (kind) {
+    case DeductionKind::COVER:
+        return "cover";
+    case DeductionKind::CANT_FIT:
+        return "fit";
+    case DeductionKind::SQUARE:
+        return "square";
+    case DeductionKind::DEPENDENCY:
+        return "dep";
+    case DeductionKind::ONE_OF:
+        return "oneof";
+    case DeductionKind::SINGLE_SOLUTION:
+        return "single-solution";
+    case DeductionKind::UNCONTESTED_NO_COVER:
+        return "uncontested-no-cover";
+    default:
+        return "none";
+    }
+}
+
+// A line the player has drawn through the hint at (r, c), from (r1, c1)
+// to (r2, c2). Coordinates are rows and columns of the board without
+// the border, as in the web client.
+struct PlayerLine {
+    int r, c, r1, c1, r2, c2;
+};
+
+struct NextHint {
+    // The player's lines that can't be right, as an index into the
+    // lines and the reason: "malformed" if the line isn't a straight
+    // line through a hint, "wrong" if it doesn't match the solution,
+    // "overlap" if it runs into another line or can't fit.
+    std::vector<std::pair<int, const char*>> contradictions;
+    // The lines cover the whole solution.
+    bool solved = false;
+    // The next deduction from the other lines, or NONE if there is
+    // none.
+    DeductionKind kind = DeductionKind::NONE;
+    int width = 0;
+    // The pieces the deduction narrowed down, as the square of the
+    // hint and the squares newly known to be covered by the piece,
+    // which may be none.
+    std::vector<std::pair<int, std::vector<int>>> pieces;
+};
+
+// Answers "what can be deduced next?" for a half-solved board, by
+// seeding the solver with the player's lines and running one step of
+// it. The puzzle is solved once up front, so that lines that don't
+// match the solution can be pointed out. next() works on a copy of the
+// Game, so one engine can serve any number of threads.
+template <class G>
+class HintEngine {
+public:
+    explicit HintEngine(const std::string& map)
+        : game_(map), hint_squares_(G::N) {
+        for (int at = 0; at < G::W * G::H; ++at) {
+            int piece = game_.hint_piece(at);
+            if (piece >= 0) {
+                hint_squares_[piece] = at;
+            }
+        }
+        G game = game_;
+        while (game.iterate().first != DeductionKind::NONE) {
+        }
+        if (game.solved()) {
+            for (int at = 0; at < G::W * G::H; ++at) {
+                solution_.push_back(game.fixed_piece(at));
+            }
+        }
+    }
+
+    // Whether the puzzle is solvable by the rules, which is needed for
+    // "wrong" and "solved".
+    bool has_solution() const {
+        return !solution_.empty();
+    }
+
+    NextHint next(const std::vector<PlayerLine>& lines) const {
+        NextHint ret;
+        G game = game_;
+        for (int i = 0; i < lines.size(); ++i) {
+            const char* error = apply(lines[i], &game);
+            if (error) {
+                ret.contradictions.emplace_back(i, error);
+            }
+        }
+
+        ret.solved = has_solution();
+        std::vector<int> fixed(G::W * G::H);
+        for (int at = 0; at < G::W * G::H; ++at) {
+            fixed[at] = game.fixed_piece(at);
+            ret.solved = ret.solved && fixed[at] == solution_[at];
+        }
+        std::vector<uint16_t> valid_o(G::N);
+        for (int piece = 0; piece < G::N; ++piece) {
+            valid_o[piece] = game.valid_orientations(piece);
+        }
+
+        auto res = game.iterate();
+        ret.kind = res.first;
+        ret.width = res.second;
+        if (ret.kind == DeductionKind::NONE) {
+            return ret;
+        }
+        std::vector<std::vector<int>> cells(G::N);
+        for (int at = 0; at < G::W * G::H; ++at) {
+            int piece = game.fixed_piece(at);
+            if (piece >= 0 && fixed[at] != piece) {
+                cells[piece].push_back(at);
+            }
+        }
+        for (int piece = 0; piece < G::N; ++piece) {
+            if (!cells[piece].empty() ||
+                game.valid_orientations(piece) != valid_o[piece]) {
+                ret.pieces.emplace_back(hint_squares_[piece],
+                                        std::move(cells[piece]));
+            }
+        }
+        return ret;
+    }
+
+    // The square of row r and column c in the coordinates of
+    // PlayerLine, or -1 if it isn't on the board.
+    static int square(int r, int c) {
+        if (r < 0 || r >= G::H || c < 0 || c >= G::W - 1) {
+            return -1;
+        }
+        return r * G::W + c + 1;
+    }
+
+private:
+    // Seed game with one line. Returns the reason if the line
+    // contradicts the puzzle or the earlier lines.
+    const char* apply(const PlayerLine& line, G* game) const {
+        int at = square(line.r, line.c);
+        int from = square(line.r1, line.c1);
+        int to = square(line.r2, line.c2);
+        if (at < 0 || from < 0 || to < 0) {
+            return "malformed";
+        }
+        int piece = game->hint_piece(at);
+        bool on_row = line.r1 == line.r && line.r2 == line.r;
+        bool on_column = line.c1 == line.c && line.c2 == line.c;
+        if (piece < 0 || !(on_row || on_column) ||
+            at < std::min(from, to) || at > std::max(from, to)) {
+            return "malformed";
+        }
+        if (has_solution()) {
+            int step = on_row ? 1 : G::W;
+            for (int i = std::min(from, to); i <= std::max(from, to);
+                 i += step) {
+                if (solution_[i] != piece) {
+                    return "wrong";
+                }
+            }
+        }
+        G seeded = *game;
+        if (!seeded.apply_line(piece, from, to)) {
+            return "overlap";
+        }
+        *game = seeded;
+        return nullptr;
+    }
+
+    G game_;
+    std::vector<int> hint_squares_;
+    // The piece covering each square in the solution, if there is one.
+    std::vector<int> solution_;
+};
+
+#endif // LINJAT_HINT_H
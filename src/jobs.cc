@@ -0,0 +1,286 @@
+#include "jobs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "linjat.h"
+#include "puzzledb.h"
+#include "writer.h"
+
+using std::string;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Run {
+    int job;
+    int index;
+};
+
+// A double-ended queue of runs per worker. Workers take runs from the
+// back of their own queue, and once it's empty, from the front of the
+// others'. No runs are added after the start, so a worker that finds
+// every queue empty is done.
+class WorkQueues {
+public:
+    explicit WorkQueues(int workers) : queues_(workers) {
+    }
+
+    void push(int worker, Run run) {
+        queues_[worker].runs.push_back(run);
+    }
+
+    bool pop(int worker, Run* run) {
+        for (int i = 0; i < queues_.size(); ++i) {
+            Queue& queue = queues_[(worker + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.runs.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                *run = queue.runs.back();
+                queue.runs.pop_back();
+            } else {
+                *run = queue.runs.front();
+                queue.runs.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Run> runs;
+    };
+    std::vector<Queue> queues_;
+};
+
+struct JobProgress {
+    int remaining = 0;
+    bool failed = false;
+    int64_t puzzles = 0;
+    Clock::time_point start = Clock::time_point::max();
+    double run_seconds = 0;
+};
+
+// The job's file name without the puzzledb directory.
+string job_name(const GenerationJob& job) {
+    size_t slash = job.file.rfind('/');
+    return slash == string::npos ? job.file : job.file.substr(slash + 1);
+}
+
+string run_file(const GenerationJob& job, const ManifestOptions& options,
+                int index) {
+    return options.work_dir + "/" + job_name(job) + "." +
+        std::to_string(options.base.seed + index);
+}
+
+// Concatenate the output of the runs of a finished job, in seed order,
+// and move it into place.
+bool finish_job(const GenerationJob& job, const ManifestOptions& options) {
+    string tmp = options.work_dir + "/" + job_name(job);
+    FILE* out = fopen(tmp.c_str(), "w");
+    if (!out) {
+        perror(tmp.c_str());
+        return false;
+    }
+    for (int i = 0; i < options.runs_per_job; ++i) {
+        string file = run_file(job, options, i);
+        string contents;
+        if (!read_file(file, &contents)) {
+            fclose(out);
+            return false;
+        }
+        fwrite(contents.data(), 1, contents.size(), out);
+    }
+    fflush(out);
+    fsync(fileno(out));
+    if (fclose(out) != 0 || rename(tmp.c_str(), job.file.c_str()) != 0) {
+        perror(job.file.c_str());
+        return false;
+    }
+    for (int i = 0; i < options.runs_per_job; ++i) {
+        remove(run_file(job, options, i).c_str());
+    }
+    return true;
+}
+
+}
+
+bool parse_manifest(const string& text, const string& puzzledb_dir,
+                    std::vector<GenerationJob>* jobs) {
+    std::istringstream lines(text);
+    string line;
+    for (int line_number = 1; std::getline(lines, line); ++line_number) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == string::npos || line[start] == '#') {
+            continue;
+        }
+        GenerationJob job;
+        char rest;
+        if (sscanf(line.c_str(), "%d %d %d %d %d %d %d %d %d %d %c",
+                   &job.height, &job.width, &job.pieces, &job.count,
+                   &job.score_cover, &job.score_cant_fit,
+                   &job.score_square, &job.score_dep, &job.score_one_of,
+                   &job.score_max_width, &rest) != 10) {
+            fprintf(stderr, "Invalid manifest line %d: '%s'\n",
+                    line_number, line.c_str());
+            return false;
+        }
+
+        char file[256];
+        snprintf(file, sizeof(file),
+                 "%s/h=%d_w=%d_p=%d_cv=%d_cf=%d_sq=%d_dep=%d",
+                 puzzledb_dir.c_str(), job.height, job.width, job.pieces,
+                 job.score_cover, job.score_cant_fit, job.score_square,
+                 job.score_dep);
+        job.file = file;
+        if (job.score_one_of) {
+            job.file += "_of=" + std::to_string(job.score_one_of);
+        }
+        jobs->push_back(job);
+    }
+    return true;
+}
+
+int run_manifest(const std::vector<GenerationJob>& jobs,
+                 const ManifestOptions& options) {
+    std::vector<JobProgress> progress(jobs.size());
+    std::vector<Run> runs;
+    for (int i = 0; i < jobs.size(); ++i) {
+        const GenerationJob& job = jobs[i];
+        if (!supported_size(BoardSize { job.height, job.width,
+                                        job.pieces })) {
+            fprintf(stderr, "%s: size %dx%d with %d pieces isn't compiled "
+                    "in, add it to LINJAT_BOARD_SIZES\n", job.file.c_str(),
+                    job.height, job.width, job.pieces);
+            return 1;
+        }
+        if (access(job.file.c_str(), F_OK) == 0) {
+            continue;
+        }
+        fprintf(stderr, "Generating %s\n", job.file.c_str());
+        progress[i].remaining = options.runs_per_job;
+        for (int j = 0; j < options.runs_per_job; ++j) {
+            runs.push_back(Run { i, j });
+        }
+    }
+
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max(1, std::min<int>(threads, runs.size()));
+    if (!runs.empty() && mkdir(options.work_dir.c_str(), 0777) != 0 &&
+        errno != EEXIST) {
+        perror(options.work_dir.c_str());
+        return 1;
+    }
+
+    // Deal the runs out round robin. Workers start from the back of
+    // their queues, so the last jobs in the manifest, which are the
+    // biggest in gen.manifest, get going first.
+    WorkQueues queues(threads);
+    for (int i = 0; i < runs.size(); ++i) {
+        queues.push(i % threads, runs[i]);
+    }
+
+    std::mutex mutex;
+    std::atomic<bool> failed(false);
+    auto work = [&] (int worker) {
+        Run run;
+        while (queues.pop(worker, &run)) {
+            const GenerationJob& job = jobs[run.job];
+            JobProgress& job_progress = progress[run.job];
+
+            GeneratorOptions run_options = options.base;
+            run_options.seed = options.base.seed + run.index;
+            run_options.puzzle_count = job.count / options.runs_per_job +
+                (run.index < job.count % options.runs_per_job);
+            run_options.score_cover = job.score_cover;
+            run_options.score_cant_fit = job.score_cant_fit;
+            run_options.score_square = job.score_square;
+            run_options.score_dep = job.score_dep;
+            run_options.score_one_of = job.score_one_of;
+            run_options.score_max_width = job.score_max_width;
+            run_options.output_file = run_file(job, options, run.index);
+            run_options.checkpoint_file =
+                run_options.output_file + ".checkpoint";
+            run_options.resume = true;
+
+            auto start = Clock::now();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job_progress.start = std::min(job_progress.start, start);
+            }
+            GeneratorResult result;
+            bool ok = run_generator(BoardSize { job.height, job.width,
+                                                job.pieces },
+                                    run_options, &result);
+            auto end = Clock::now();
+
+            bool done;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job_progress.failed = job_progress.failed || !ok;
+                job_progress.puzzles += result.puzzles -
+                    result.duplicates - result.wasted;
+                job_progress.run_seconds +=
+                    std::chrono::duration<double>(end - start).count();
+                done = --job_progress.remaining == 0;
+            }
+            if (!done) {
+                continue;
+            }
+
+            // Only the thread that finished the last run gets here.
+            if (job_progress.failed || !finish_job(job, options)) {
+                fprintf(stderr, "%s: failed, not written\n",
+                        job.file.c_str());
+                failed = true;
+                continue;
+            }
+            double seconds = std::chrono::duration<double>(
+                end - job_progress.start).count();
+            char line[512];
+            snprintf(line, sizeof(line),
+                     "{\"file\": %s, \"puzzles\": %ld, \"runs\": %d, "
+                     "\"seconds\": %.1f, \"run_seconds\": %.1f, "
+                     "\"puzzles_per_s\": %.3f, "
+                     "\"puzzles_per_run_s\": %.3f}\n",
+                     json_string(job.file).c_str(), job_progress.puzzles,
+                     options.runs_per_job, seconds, job_progress.run_seconds,
+                     seconds > 0 ? job_progress.puzzles / seconds : 0.0,
+                     job_progress.run_seconds > 0 ?
+                     job_progress.puzzles / job_progress.run_seconds : 0.0);
+            output_writer.write(stdout, line);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back(work, t);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (failed) {
+        return 1;
+    }
+    // Only goes if every run's files have been cleaned up.
+    rmdir(options.work_dir.c_str());
+    return 0;
+}
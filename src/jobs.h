@@ -0,0 +1,59 @@
+#ifndef LINJAT_JOBS_H
+#define LINJAT_JOBS_H
+
+#include <string>
+#include <vector>
+
+#include "generator_options.h"
+
+// One line of a --manifest: generate count puzzles of one size with
+// one set of scores into a puzzledb file, like gen() in gen.sh.
+struct GenerationJob {
+    int height = 0;
+    int width = 0;
+    int pieces = 0;
+    int count = 0;
+    int score_cover = 0;
+    int score_cant_fit = 0;
+    int score_square = 0;
+    int score_dep = 0;
+    int score_one_of = 0;
+    int score_max_width = 0;
+    // Named after the size and scores, like gen.sh does.
+    std::string file;
+};
+
+// Parse a manifest with one job per line, as the whitespace-separated
+// fields "H W P N CV CF SQ DEP OF MW" in the order that gen() takes
+// them. Blank lines and lines starting with '#' are skipped.
+bool parse_manifest(const std::string& text, const std::string& puzzledb_dir,
+                    std::vector<GenerationJob>* jobs);
+
+struct ManifestOptions {
+    // The settings shared by all jobs. The count, seed, scores and
+    // files are filled in for each run.
+    GeneratorOptions base;
+    // Each job is split into this many runs, with seeds base.seed,
+    // base.seed + 1 and so on, so that a job can use several threads.
+    int runs_per_job = 10;
+    // 0 for one per core.
+    int threads = 0;
+    // Where the output and checkpoints of unfinished runs go. Not in
+    // the puzzledb directory, where the globs over puzzle files would
+    // pick them up, but on the same file system, so that a finished
+    // job's file can be renamed into place.
+    std::string work_dir;
+};
+
+// Generate the jobs whose files don't exist yet. The runs of all jobs
+// are shared out between worker threads that steal from each other
+// when they run out, so that one slow job doesn't leave the others
+// idle. Each run checkpoints like --checkpoint_file --resume into
+// work_dir, and a job's file only appears, complete, once all of its
+// runs are done.
+// Prints the throughput of each job as a JSON line. Returns 0 if all
+// jobs were completed.
+int run_manifest(const std::vector<GenerationJob>& jobs,
+                 const ManifestOptions& options);
+
+#endif // LINJAT_JOBS_H
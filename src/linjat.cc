@@ -0,0 +1,131 @@
+#include "linjat.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include "board_sizes.h"
+#include "game.h"
+#include "generator.h"
+
+namespace {
+
+template <class G>
+bool solve(std::string_view map, Classification* cls, int8_t* solution) {
+    if (!G::valid_map(map)) {
+        return false;
+    }
+    G game(map);
+    *cls = classify_game_in_place(&game);
+    if (solution) {
+        for (int at = 0; at < G::W * G::H; ++at) {
+            if (at % G::W) {
+                *solution++ = game.fixed_piece(at);
+            }
+        }
+    }
+    return true;
+}
+
+template <class G>
+bool generate(const GeneratorOptions& options, GeneratorResult* result) {
+    generator_options = options;
+    bool started = reset_generator() && open_output<G>();
+    if (started) {
+        generate_puzzles<G>();
+        close_output();
+    }
+    result->puzzles = stats.puzzles;
+    result->wasted = stats.wasted;
+    result->duplicates = stats.duplicates;
+    result->gave_up = stats.gave_up;
+    result->out_of_time = stats.out_of_time;
+    result->interrupted = stats.interrupted;
+    BufferStream json;
+    stats.print_json(json.fp());
+    result->stats_json = json.take();
+    return started && !stats.gave_up && !stats.interrupted && !stats.failed;
+}
+
+struct SizeFunctions {
+    bool (*solve)(std::string_view map, Classification* cls,
+                  int8_t* solution);
+    bool (*generate)(const GeneratorOptions& options,
+                     GeneratorResult* result);
+};
+
+const SizeFunctions* size_functions(const BoardSize& size) {
+#define SIZE(h, w, p)                                                   \
+    if (size.height == h && size.width == w && size.pieces == p) {      \
+        static const SizeFunctions functions = {                        \
+            solve<Game<h, w, p>>, generate<Game<h, w, p>>,              \
+        };                                                              \
+        return &functions;                                              \
+    }
+    LINJAT_BOARD_SIZES(SIZE)
+#if defined(MAP_HEIGHT) && defined(MAP_WIDTH) && defined(PIECES)
+    SIZE(MAP_HEIGHT, MAP_WIDTH, PIECES)
+#endif
+#undef SIZE
+    return nullptr;
+}
+
+}
+
+bool supported_size(const BoardSize& size) {
+    return size_functions(size) != nullptr;
+}
+
+bool parse_puzzle(const std::vector<std::string>& rows, BoardSize* size,
+                  std::string* map) {
+    size->height = rows.size();
+    size->width = rows.empty() ? 0 : rows[0].size();
+    size->pieces = 0;
+    map->clear();
+    for (const auto& row : rows) {
+        if (row.size() != size->width) {
+            return false;
+        }
+        *map += "," + row;
+        size->pieces += std::count_if(row.begin(), row.end(), ::isdigit);
+    }
+    return true;
+}
+
+bool solve_puzzle(const BoardSize& size, std::string_view map,
+                  Classification* cls, int8_t* solution) {
+    const SizeFunctions* functions = size_functions(size);
+    return functions && functions->solve(map, cls, solution);
+}
+
+bool parse_disabled_rules(const std::string& list,
+                          GeneratorOptions* options) {
+    size_t at = 0;
+    while (at < list.size()) {
+        size_t end = list.find(',', at);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string rule = list.substr(at, end - at);
+        if (rule == "square") {
+            options->disabled_rules |= RULE_SQUARE;
+        } else if (rule == "dep") {
+            options->disabled_rules |= RULE_DEPENDENCY;
+        } else if (rule == "oneof") {
+            options->disabled_rules |= RULE_ONE_OF;
+        } else if (rule == "unscored") {
+            options->disable_unscored_rules = true;
+        } else {
+            fprintf(stderr, "Unknown rule '%s' to disable\n",
+                    rule.c_str());
+            return false;
+        }
+        at = end + 1;
+    }
+    return true;
+}
+
+bool run_generator(const BoardSize& size, const GeneratorOptions& options,
+                   GeneratorResult* result) {
+    const SizeFunctions* functions = size_functions(size);
+    return functions && functions->generate(options, result);
+}
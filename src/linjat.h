@@ -0,0 +1,75 @@
+#ifndef LINJAT_LINJAT_H
+#define LINJAT_LINJAT_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "classification.h"
+#include "generator_options.h"
+
+// The interface of the linjat library, for programs that solve or
+// generate puzzles in-process instead of running mklinjat. Everything
+// is configured through the arguments; nothing here reads flags or
+// exits. The board size is a run-time argument, and can be any of the
+// sizes in board_sizes.h or the one the library was compiled with.
+
+struct BoardSize {
+    int height = 0;
+    int width = 0;
+    int pieces = 0;
+};
+
+// Whether the library was built with this board size.
+bool supported_size(const BoardSize& size);
+
+// The size of a puzzle given as rows of hints, dots and spaces, like
+// in the puzzledb, and the puzzle in the format of --solve. Returns
+// false if the rows aren't all of the same width.
+bool parse_puzzle(const std::vector<std::string>& rows, BoardSize* size,
+                  std::string* map);
+
+// Solve a puzzle in the format of --solve with the deduction rules,
+// and classify it. If solution isn't null, it must have room for
+// height * width entries, which are set to the piece covering each
+// square, row by row, or -1 if the solver didn't place one there or
+// it's left empty. Returns false if the puzzle isn't of the given size
+// or the size isn't supported. This is the only function here that
+// does no heap allocation, so it can be called in a tight loop; the
+// others allocate as they go.
+bool solve_puzzle(const BoardSize& size, std::string_view map,
+                  Classification* cls, int8_t* solution = nullptr);
+
+// Set options->disabled_rules from a comma-separated list of "square",
+// "dep" and "oneof", and disable_unscored_rules for "unscored". Returns
+// false, after printing it, on an unknown name.
+bool parse_disabled_rules(const std::string& list, GeneratorOptions* options);
+
+struct GeneratorResult {
+    // Optimized puzzles, and how many of those weren't written because
+    // no open quota wanted them or they were duplicates.
+    int64_t puzzles = 0;
+    int64_t wasted = 0;
+    int64_t duplicates = 0;
+    bool gave_up = false;
+    bool out_of_time = false;
+    bool interrupted = false;
+    // All the stats of the run, as JSON like mklinjat --stats_file.
+    std::string stats_json;
+};
+
+// Do a generator run on the calling thread: like mklinjat without
+// --manifest, options.output_file or stdout gets the puzzles. Runs on
+// different threads are independent. Returns false if the size isn't
+// supported, the options don't parse, or the run gave up, was
+// interrupted or couldn't write a checkpoint.
+bool run_generator(const BoardSize& size, const GeneratorOptions& options,
+                   GeneratorResult* result);
+
+// Make SIGINT and SIGTERM stop runs cleanly before their next puzzle,
+// with the output flushed and a checkpoint to resume from. A second
+// signal kills the process as usual.
+void stop_on_signals();
+
+#endif // LINJAT_LINJAT_H
@@ -1,16 +1,15 @@
 #include <algorithm>
-#include <bitset>
-#include <cassert>
-#include <cstdlib>
-#include <cstdint>
 #include <cstdio>
-#include <cstring>
-#include <functional>
 #include <gflags/gflags.h>
-#include <map>
-#include <set>
+#include <string>
 #include <vector>
 
+#include "dedup.h"
+#include "jobs.h"
+#include "linjat.h"
+#include "modes.h"
+#include "puzzledb.h"
+
 using std::string;
 
 #if !defined(MAP_WIDTH)
@@ -35,6 +34,9 @@ DEFINE_string(solve_progress_file, "",
 DEFINE_string(candidate_progress_file, "",
               "Print solver state after each candidate-generation "
               "iteration in this file.");
+DEFINE_int32(benchmark_iterations, 0,
+             "If non-zero, time this many Game copies and "
+             "classifications, print the results and exit.");
 
 DEFINE_int32(score_cover, 1,
              "Weight given to basic covering deduction rule.");
@@ -56,1476 +58,433 @@ DEFINE_int32(score_uncontested_no_cover, -1,
              "Weight given to being able to 'cheat' by knowing the "
              "puzzle has exactly one solution.");
 
-enum DeductionKind {
-    NONE = 0,
-    COVER = 1,
-    CANT_FIT = 2,
-    SQUARE = 3,
-    DEPENDENCY = 4,
-    ONE_OF = 5,
-    SINGLE_SOLUTION = 6,
-    UNCONTESTED_NO_COVER = 7,
-};
-
-class Game {
-public:
-    static const int W = MAP_WIDTH + 1, H = MAP_HEIGHT, N = PIECES;
-
-    using Hint = std::pair<uint16_t, uint16_t>;
-    using Mask = uint64_t;
-    using MaskArray = std::array<Mask, H * W>;
-    using DepMask = std::bitset<H * W>;
-
-    using IterationResult = std::pair<DeductionKind, int>;
-
-    Game(std::string puzzle = "") {
-        for (int r = 0; r < H; ++r) {
-            border_[r * W] = 1;
-        }
-        if (!puzzle.empty()) {
-            setup_map(puzzle);
-        } else {
-            randomize();
-        }
-        reset_hints();
-        reset_possible();
-        update_possible();
-        orig_possible_ = possible_;
-    }
-
-    void randomize() {
-        for (int i = 0; i < N; ++i) {
-            while (1) {
-                int at = random() % (W * H);
-                int val = 2 + random() % 4;
-                if (!fixed_[at] && !border_[at]) {
-                    hints_[i] = Hint(at, val);
-                    fixed_[at] = piece_mask(i);
-                    break;
-                }
-            }
-        }
-    }
-
-    void setup_map(const std::string& map) {
-        assert(map.size() == W * H);
-
-        int pieces = 0;
-        for (int i = 0; i < H * W; ++i) {
-            if (map[i] == ',') {
-                assert(border_[i]);
-            } else if (map[i] == '.') {
-                forced_[i] = true;
-            } else if (isdigit(map[i])) {
-                int val = map[i] - '0';
-                hints_[pieces] = Hint(i, val);
-                fixed_[i] = piece_mask(pieces++);
-            }
-        }
-
-        assert(pieces == N);
-    }
-
-    void reset_hints() {
-        for (int at = 0; at < W * H; ++at) {
-            fixed_[at] = 0;
-        }
-        for (int i = 0; i < N; ++i) {
-            auto& hint = hints_[i];
-            fixed_[hint.first] = piece_mask(i);
-        }
-        for (int i = 0; i < N; ++i) {
-            valid_orientation_[i] = init_valid_orientations(i);
-        }
-    }
-
-    void print_puzzle(bool json) {
-        std::map<int, int> hints;
-        for (auto hint : hints_) {
-            hints[hint.first] = hint.second;
-        }
-
-        int at = 0;
-        for (int r = 0; r < H; ++r) {
-            if (json) {
-                printf("\"");
-            }
-            for (int c = 0; c < W; ++c) {
-                if (!border_[at]) {
-                    if (hints.count(at)) {
-                        printf("%d", hints[at]);
-                    } else if (forced_[at]) {
-                        printf(".");
-                    } else {
-                        printf(" ");
-                    }
-                }
-                ++at;
-            }
-            if (json) {
-                printf("\"");
-                if (r != H - 1) {
-                    printf(", ");
-                }
-            } else {
-                printf("\n");
-            }
-        }
-    }
-
-    void print_fixed() {
-        int at = 0;
-        for (int r = 0; r < H; ++r) {
-            for (int c = 0; c < W; ++c) {
-                if (!border_[at]) {
-                    if (fixed_[at]) {
-                        fprintf(stderr,
-                                "%d",
-                                hints_[__builtin_ctz(fixed_[at])].second);;
-                    } else if (forced_[at]) {
-                        fprintf(stderr, ".");
-                    } else if (!possible_[at]) {
-                        fprintf(stderr, "_");
-                    } else {
-                        fprintf(stderr, " ");
-                    }
-                }
-                ++at;
-            }
-            fprintf(stderr, "|\n");
-        }
-        fprintf(stderr, "\n");
-    }
-
-    void print_possible() {
-        int at = 0;
-        for (int r = 0; r < H; ++r) {
-            for (int c = 0; c < W; ++c) {
-                // if (!border_[at]) {
-                //     printf("%d ",
-                //            fixed_[at] ?
-                //            hints_[__builtin_ctz(fixed_[at])].second :
-                //            0);
-                // }
-                if (!border_[at]) {
-                    if (false) {
-                        printf("[%d %d] ",
-                               possible_count(at),
-                               __builtin_popcountl(orig_possible_[at]) -
-                               possible_count(at));
-                    } else if (possible_count(at)) {
-                        printf("% 2d%c%d ",
-                               possible_count(at),
-                               forced_[at] ? 'X' : '?',
-                               fixed_[at] ?
-                               hints_[mask_to_piece(fixed_[at])].second :
-                               0);
-                    } else {
-                        bool printed = false;
-                        for (int p = 0; p < N; ++p) {
-                            if (hints_[p].first == at) {
-                                printf(" % 3d ",
-                                       // valid_orientation_[p]);
-                                       orientation_count(p));
-                                printed = true;
-                            }
-                        }
-                        if (!printed)
-                            printf("  .  ");
-                    }
-                }
-                ++at;
-            }
-            printf("\n");
-        }
-    }
-
-    void print_json(FILE* f, const char* extra_json) {
-        fprintf(f, "{%s\"height\":%d, \"width\":%d, \"lines\":[\n",
-                extra_json, H, W -1);
-        for (int piece = 0; piece < N; ++piece) {
-            int at = hints_[piece].first;
-            int value = hints_[piece].second;
-            int r = at / W, c = at % W;
-            int minr = r, maxr = r, minc = c, maxc = c;
-            for (int at = 0; at < W * H; ++at) {
-                if (fixed_[at] == piece_mask(piece)) {
-                    minr = std::min(minr, at / W);
-                    maxr = std::max(maxr, at / W);
-                    minc = std::min(minc, at % W);
-                    maxc = std::max(maxc, at % W);
-                }
-            }
-
-            int valid_o = valid_orientation_[piece];
-            bool have_vertical = false, have_horizontal = false;
-            for (int o = 0; o < value * 2; ++o) {
-                if (valid_o & (1 << o)) {
-                    if (o & 1) {
-                        have_vertical = true;
-                    } else {
-                        have_horizontal = true;
-                    }
-                }
-            }
-
-            fprintf(f,
-                    "{\"r\":%d,\"c\":%d,\"value\":\"%d\",",
-                    r, c - 1, value);
-            if (have_vertical != have_horizontal) {
-                fprintf(f,
-                        "\"hz\":%d,"
-                        "\"minr\":%d,\"minc\":%d,\"maxr\":%d,\"maxc\":%d,\n",
-                        have_horizontal,
-                        minr, minc - 1,
-                        maxr, maxc - 1);
-            }
-            fprintf(f,
-                    "},\n");
-        }
-        fprintf(f, "],\"dots\":[\n");
-        for (int at = 0; at < W * H; ++at) {
-            if (forced_[at]) {
-                fprintf(f,
-                        "{\"r\":%d,\"c\":%d},\n", at / W, at % W - 1);
-            }
-        }
-        fprintf(f, "],\n");
-        fprintf(f, "},\n");
-    }
-
-    void reset_possible() {
-        for (int at = 0; at < W * H; ++at) {
-            possible_[at] = 0;
-        }
-    }
-
-    IterationResult iterate() {
-        reset_possible();
-
-        {
-            update_possible();
-            int count;
-
-            count = update_uncontested_no_cover();
-            if (count) {
-                return { DeductionKind::UNCONTESTED_NO_COVER, count };
-            }
-
-            count = update_forced_coverage();
-            if (count) {
-                return { DeductionKind::COVER, count };
-            }
-
-            // Put this after forced_coverage, since it's not interesting
-            // if abusing knowledge of a single solution gives just the
-            // same deduction as the trivial rule.
-            count = update_knowledge_of_single_solution();
-            if (count) {
-                update_forced_coverage();
-                return { DeductionKind::SINGLE_SOLUTION, count };
-            }
-
-            count = update_cant_fit();
-            if (count) {
-                return { DeductionKind::CANT_FIT, count };
-            }
-        }
-
-
-        {
-            update_square();
-            // Is there really no need to check u_forced_coverage
-            // here?
-            int count = update_cant_fit();
-            if (count) {
-                return { DeductionKind::SQUARE, count };
-            }
-        }
-
-        {
-            update_dependent();
-            int count = update_cant_fit();
-            if (count) {
-                return { DeductionKind::DEPENDENCY, count };
-            }
-        }
-
-        {
-            update_one_of();
-            int count = update_cant_fit();
-            if (count) {
-                return { DeductionKind::ONE_OF, count };
-            }
-        }
-
-        return { DeductionKind::NONE, 0 };
-    }
-
-    int update_cant_fit() {
-        int count = 0;
-        for (int piece = 0; piece < N; ++piece) {
-            count += update_cant_fit_for_piece(piece);
-        }
-        return count;
-    }
-
-    int update_forced_coverage() {
-        int count = 0;
-        for (int piece = 0; piece < N; ++piece) {
-            count += update_forced_coverage_for_piece(piece);
-        }
-        return count;
-    }
+DEFINE_string(quotas, "",
+              "Instead of --puzzle_count puzzles, generate until each "
+              "quota is full. Quotas are separated by ';', each one is "
+              "'count:predicate,predicate,...' where a predicate compares "
+              "a classification field or 'score' to a number, e.g. "
+              "'99:dep.depth>=2,all.max_width<=2'.");
+DEFINE_int32(quota_max_puzzles, 0,
+             "Give up on --quotas after generating this many puzzles. "
+             "0 means no limit.");
+DEFINE_int32(quota_max_misses, 1000,
+             "Give up on --quotas after this many puzzles in a row that "
+             "no open quota accepted, or that were duplicates. 0 means "
+             "no limit.");
+DEFINE_int32(quota_steer_weight, 100,
+             "Optimization score bonus for each predicate of the "
+             "targeted quota that a candidate satisfies.");
+DEFINE_string(collection_score,
+              "cover.depth=1,cant_fit.depth=1,square.depth=10,"
+              "dep.depth=50,one_of.depth=20,single-solution.depth=-200,"
+              "uncontested-no-cover.depth=-50,all.max_width=-2",
+              "Weights of the score used for selecting puzzles for the "
+              "collection, as comma-separated field=weight pairs. The "
+              "default matches build-puzzle-collection.pl.");
+DEFINE_string(stats_file, "",
+              "Write generation statistics as JSON to this file.");
+DEFINE_bool(build_collection, false,
+            "Instead of generating puzzles, build the puzzle collection "
+            "for the web client from the puzzledb files, and write it to "
+            "stdout.");
+DEFINE_string(puzzledb_dir, "puzzledb",
+              "Directory with the puzzledb files for --build_collection.");
+DEFINE_int32(collection_size, 99,
+             "Number of puzzles per difficulty in the collection.");
+DEFINE_string(collection_merge, "",
+              "Comma-separated key:file pairs. Use the value of key in the "
+              "JSON file in place of the generated one.");
+DEFINE_bool(dedup, true,
+            "Drop generated puzzles that are mirror images or rotations "
+            "of an earlier puzzle, and generate a new one instead.");
+DEFINE_string(dedup_against, "",
+              "Glob pattern of puzzledb files. With --dedup, also drop "
+              "generated puzzles that already appear in those files.");
+DEFINE_bool(dedup_puzzledb, false,
+            "Instead of generating puzzles, remove duplicate puzzles "
+            "from the files in --puzzledb_dir.");
+DEFINE_string(output_file, "",
+              "Write the generated puzzles to this file instead of stdout.");
+DEFINE_string(checkpoint_file, "",
+              "Periodically save the generator state to this file, so "
+              "that a killed run can be continued with --resume. "
+              "Requires --output_file.");
+DEFINE_bool(resume, false,
+            "Continue from --checkpoint_file if it exists. The other "
+            "flags must be the same as for the original run.");
+DEFINE_int32(checkpoint_interval_s, 60,
+             "Seconds between checkpoints.");
+DEFINE_int32(time_budget_ms, 0,
+             "Wall-clock budget in milliseconds for generating one "
+             "puzzle, including the candidate search. When it runs out, "
+             "the best puzzle found so far is used. 0 for no limit.");
+DEFINE_int32(run_time_budget_ms, 0,
+             "Wall-clock budget in milliseconds for the whole run. When "
+             "it runs out, generation stops with the puzzles finished "
+             "so far. 0 for no limit.");
+DEFINE_int32(max_candidate_attempts, 1000000,
+             "Give up on generating puzzles if no solvable candidate is "
+             "found in this many attempts.");
+DEFINE_int32(max_candidate_retries, 10,
+             "With --time_budget_ms, give up on generating puzzles if the "
+             "candidate search for one puzzle runs out of time this many "
+             "more times after the first.");
+DEFINE_bool(fast_reject, false,
+            "Reject random games that can't make a solvable candidate "
+            "with cheap checks, before placing dots. Uses the RNG "
+            "differently, so the puzzles differ from a run without it.");
+DEFINE_int32(fast_reject_min_overlap, 0,
+             "With --fast_reject, also reject games with fewer than this "
+             "many squares that two pieces could cover.");
+DEFINE_bool(constructive, false,
+            "Take the hints of candidates from a random layout of pieces "
+            "that don't overlap, rather than placing them at random, "
+            "so that each one has a solution before the dots go in.");
+DEFINE_string(disable_rules, "",
+              "Comma-separated deduction rules to leave out when solving, "
+              "classifying and placing dots: square, dep and oneof, or "
+              "unscored for those with a zero --score_* weight.");
+DEFINE_bool(perf_counters, false,
+            "Count cycles, instructions, branch misses and L1D misses "
+            "per generation phase with perf_event_open(), and add them "
+            "to the --stats_file output.");
+DEFINE_string(verify_db, "",
+              "Glob pattern of puzzledb files. Instead of generating "
+              "puzzles, classify every puzzle of the compiled-in size "
+              "in them again, and compare with --verify_golden or the "
+              "stored classifications. Exits with status 1 on any "
+              "difference.");
+DEFINE_string(verify_golden, "",
+              "File with the expected classifications for --verify_db, "
+              "one per line, in place of the stored ones.");
+DEFINE_bool(verify_update_golden, false,
+            "Write --verify_golden from the current classifications "
+            "instead of comparing against it.");
+DEFINE_string(verify_rate_file, "",
+              "File with the throughput per thread of an earlier "
+              "--verify_db run on this machine, for "
+              "--verify_max_slowdown. Written with the current "
+              "throughput if it doesn't exist yet.");
+DEFINE_double(verify_max_slowdown, 0,
+              "Also fail if the throughput per thread is more than this "
+              "fraction below the one in --verify_rate_file. 0 to not "
+              "check.");
+DEFINE_int32(threads, 0,
+             "Worker threads for --verify_db and --manifest. 0 for one "
+             "per core.");
+DEFINE_int32(output_batch, 10,
+             "Also checkpoint, and sync --output_file to disk, after "
+             "this many puzzles have been written.");
+DEFINE_bool(adaptive_mutation, false,
+            "Pick the optimizer's mutation operators (including swapping "
+            "two hints, nudging a hint and moving a dot) by how often "
+            "they have produced solvable or better puzzles, instead of "
+            "uniformly among shrinking, growing and relocating a hint. "
+            "Per-operator rates are in the --stats_file output either "
+            "way.");
+DEFINE_string(manifest, "",
+              "Instead of generating puzzles of the compiled-in size, do "
+              "the jobs in this file, one per line, with the arguments "
+              "of gen() in gen.sh: H W P N CV CF SQ DEP OF MW. Puzzles "
+              "go to files in --puzzledb_dir, and jobs whose file "
+              "already exists are skipped.");
+DEFINE_string(manifest_work_dir, "",
+              "Directory for the output and checkpoints of --manifest "
+              "runs that haven't finished. Defaults to --puzzledb_dir "
+              "with .work appended.");
+DEFINE_int32(manifest_runs, 10,
+             "Split each --manifest job into this many runs, with seeds "
+             "--seed, --seed + 1 and so on, that can go on different "
+             "threads.");
+DEFINE_int32(pareto_archive, 0,
+             "Also keep up to this many of the puzzles that the optimizer "
+             "found for each record that are Pareto-optimal on the "
+             "--score_* components, under \"archive\" in the record. "
+             "0 to not keep any.");
+DEFINE_int32(archive_epsilon, 1,
+             "Treat component depths within this many steps of each "
+             "other as equal when deciding what goes in the "
+             "--pareto_archive, to keep it spread out.");
+DEFINE_string(select_from_archive, "",
+              "Instead of generating puzzles, write the best-scoring of "
+              "each record and its --pareto_archive puzzles, by the "
+              "--score_* weights, for the files matching this glob "
+              "pattern.");
+DEFINE_int32(plateau_iterations, 0,
+             "Consider the optimizer stuck once the best score hasn't "
+             "improved in this many iterations, and stop optimizing the "
+             "puzzle early, or restart with --plateau_restarts. 0 to "
+             "always do --optimize_iterations. The iterations used per "
+             "puzzle are in the --stats_file output.");
+DEFINE_int32(plateau_restarts, 0,
+             "When the optimizer gets stuck, start over from a new "
+             "candidate puzzle up to this many times per puzzle, keeping "
+             "the best result, before stopping early.");
+DEFINE_string(shard, "",
+              "i/n: generate only puzzles i, i + n, i + 2n and so on of "
+              "--puzzle_count, with the RNG seeded from --seed and the "
+              "puzzle's index, which goes into its record. Runs for all "
+              "i from 0 to n - 1, on any number of machines, together "
+              "make the same puzzles for any n. Combine them with "
+              "--merge_shards.");
+DEFINE_string(merge_shards, "",
+              "Instead of generating puzzles, write the records of the "
+              "--shard outputs matching this glob pattern in index "
+              "order, without duplicates if --dedup is set.");
+DEFINE_string(pipeline, "",
+              "Generate in a pipeline with C,O,F threads for the candidate "
+              "search, the optimizer, and the final classification and "
+              "formatting, e.g. 1,6,1. Like --shard, each puzzle index "
+              "gets its own RNG seed, so the puzzles and their order don't "
+              "depend on the thread counts. Without --shard, it generates "
+              "the same puzzles as --shard=0/1, without duplicates if "
+              "--dedup is set.");
+DEFINE_int32(pipeline_queue, 4,
+             "Number of puzzles that can wait between two --pipeline "
+             "stages.");
+DEFINE_bool(differential, false,
+            "Instead of generating puzzles, solve random candidate "
+            "puzzles and the puzzles in --puzzledb_dir step by step with "
+            "both Game and the unoptimized ReferenceGame, and check that "
+            "they make the same deductions. Prints the throughput of "
+            "both, and a --solve string for the first puzzle where they "
+            "differ.");
+DEFINE_int32(differential_random, 1000,
+             "Number of random candidate puzzles for --differential.");
+DEFINE_string(solution_space, "",
+              "Instead of generating puzzles, count the solutions of the "
+              "puzzles in the files matching this glob pattern by "
+              "exhaustive search rather than with the deduction rules, and "
+              "print each with a map of how many pieces can cover each "
+              "square.");
+DEFINE_int32(solution_space_max_nodes, 10000000,
+             "Give up on counting the solutions of a puzzle for "
+             "--solution_space after this many search nodes.");
+DEFINE_bool(hint_server, false,
+            "Instead of generating puzzles, read requests of the form "
+            "{\"puzzle\": [rows], \"lines\": [[r, c, r1, c1, r2, c2], "
+            "...]} from stdin, one per line, and answer each with the "
+            "next deduction from the player's lines and the lines that "
+            "contradict the solution.");
+
+void write_stats(const GeneratorResult& result) {
+    if (FLAGS_stats_file.empty()) {
+        return;
+    }
+    FILE* fp = fopen(FLAGS_stats_file.c_str(), "w");
+    if (!fp) {
+        perror(FLAGS_stats_file.c_str());
+        return;
+    }
+    fputs(result.stats_json.c_str(), fp);
+    fclose(fp);
+}
 
-    void reset_forced() {
-        for (int i = 0; i < W * H; ++i) {
-            forced_[i] = false;
+int collection() {
+    CollectionOptions options;
+    options.puzzledb_dir = FLAGS_puzzledb_dir;
+    options.size = FLAGS_collection_size;
+    options.seed = FLAGS_seed;
+    options.score = FLAGS_collection_score;
+
+    const string& merge = FLAGS_collection_merge;
+    size_t start = 0;
+    while (start < merge.size()) {
+        size_t end = std::min(merge.find(',', start), merge.size());
+        string arg = merge.substr(start, end - start);
+        size_t colon = arg.find(':');
+        if (colon == string::npos) {
+            fprintf(stderr, "Invalid --collection_merge '%s'\n",
+                    arg.c_str());
+            return 1;
         }
+        options.merge.emplace_back(arg.substr(0, colon),
+                                   arg.substr(colon + 1));
+        start = end + 1;
     }
 
-    bool force_one_square(int possible_mask = (1 << N) - 1) {
-        int best_at = -1;
-        int best_score = -1;
-        int best_score_count;
-
-        for (int at = 0; at < W *H; ++at) {
-            if (fixed_[at] || forced_[at] ||
-                !(possible_[at] & possible_mask)) {
-                continue;
-            }
-            int score = orig_possible_count(at) + possible_count(at);
-            if (score > best_score) {
-                best_score = score;
-                best_at = at;
-                best_score_count = 1;
-            } else if (best_score == score) {
-                ++best_score_count;
-                if (rand() % best_score_count == 0) {
-                    best_at = at;
-                }
-            }
-        }
+    return build_collection(options, stdout);
+}
 
-        if (best_at >= 0) {
-            forced_[best_at] = true;
-            return true;
-        }
+bool parse_shard(const string& shard, GeneratorOptions* options) {
+    char rest;
+    if (sscanf(shard.c_str(), "%d/%d%c", &options->shard_index,
+               &options->shard_count, &rest) != 2 ||
+        options->shard_count <= 0 || options->shard_index < 0 ||
+        options->shard_index >= options->shard_count) {
+        fprintf(stderr, "Invalid --shard '%s', expected i/n with "
+                "0 <= i < n\n", shard.c_str());
         return false;
     }
-
-    bool force_if_uncontested() {
-        reset_possible();
-        update_possible();
-        bool ret = false;
-        for (int piece = 0; piece < N; ++piece) {
-            if (!find_uncontested_no_cover(piece))
-                continue;
-            assert(force_one_square(piece_mask(piece)));
-            ret = true;
-        }
-
-        return ret;
-    }
-
-    bool impossible() {
-        for (int piece = 0; piece < N; ++piece) {
-            if (!valid_orientation_[piece])
-                return true;
-        }
-
-        for (int at = 0; at < W *H; ++at) {
-            if (forced_[at] && !possible_[at]) {
-                return true;
-            }
-        }
-
+    if (!options->quotas.empty()) {
+        fprintf(stderr, "--shard can't be combined with --quotas\n");
         return false;
     }
+    return true;
+}
 
-    bool solved() {
-        for (int piece = 0; piece < N; ++piece) {
-            if (orientation_count(piece) != 1) {
-                return false;
-            }
-        }
-
-        for (int at = 0; at < W *H; ++at) {
-            if (forced_[at] && !fixed_[at]) {
-                return false;
-            }
-        }
-
-        validate();
-
-        return true;
-    }
-
-    void validate() {
-        std::array<int, N> count { 0 };
-        for (int piece = 0; piece < N; ++piece) {
-            assert(orientation_count(piece) == 1);
-            for (int at : PieceOrientationIterator(
-                     hints_[piece],
-                     __builtin_ctzl(valid_orientation_[piece]))) {
-                if (fixed_[at]) {
-                    assert(fixed_[at] == piece_mask(piece));
-                } else {
-                    fixed_[at] = piece_mask(piece);
-                }
-            }
-        }
-
-        for (int at = 0; at < W * H; ++at) {
-            if (forced_[at]) {
-                assert(fixed_[at]);
-            }
-            if (fixed_[at]) {
-                count[mask_to_piece(fixed_[at])]++;
-            }
-        }
-
-        for (int piece = 0; piece < N; ++piece) {
-            assert(count[piece] == hints_[piece].second);
-        }
-    }
-
-    void mutate() {
-        do {
-            int piece = rand() % Game::N;
-            int at = hints_[piece].first;
-            int size = hints_[piece].second;
-
-            switch (rand() % 3) {
-            case 0:
-                if (size > 1)
-                    hints_[piece].second--;
-                break;
-            case 1:
-                if (size < 8)
-                    hints_[piece].second++;
-                break;
-            case 2:
-                fixed_[at] = 0;
-                while (1) {
-                    int at = random() % (W * H);
-                    if (!fixed_[at] && !border_[at]) {
-                        hints_[piece].first = at;
-                        fixed_[at] = piece_mask(piece);
-                        break;
-                    }
-                }
-                break;
-            default:
-                break;
-            }
-        } while (rand() % 3 < 1);
-
-        reset_hints();
-        reset_possible();
-        update_possible();
-        orig_possible_ = possible_;
-    }
-
-private:
-    int orig_possible_count(int at) {
-        return __builtin_popcountl(orig_possible_[at]);
-    }
-
-    int possible_count(int at) {
-        return __builtin_popcountl(possible_[at]);
-    }
-
-    Mask piece_mask(uint64_t piece) {
-        return UINT64_C(1) << piece;
-    }
-
-    int mask_to_piece(Mask mask) {
-        return __builtin_ctzl(mask);
-    }
-
-    int orientation_count(int piece) {
-        return __builtin_popcountl(valid_orientation_[piece]);
-    }
-
-    void update_possible() {
-        for (int piece = 0; piece < N; ++piece) {
-            update_possible_for_piece(piece);
-        }
-    }
-
-    void update_possible_for_piece(int piece) {
-        Mask mask = piece_mask(piece);
-        int size = hints_[piece].second;
-        int valid_o = valid_orientation_[piece];
-
-        for (int o = 0; o < size * 2; ++o) {
-            if (valid_o & (1 << o)) {
-                int count = 0;
-                for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                    if (!fixed_[at] || fixed_[at] == mask) {
-                        ++count;
-                    }
-                }
-                if (count == size) {
-                    for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                        possible_[at] |= mask;
-                    }
-                } else {
-                    valid_orientation_[piece] &= ~(1 << o);
-                }
-            }
-        }
-    }
-
-    int update_forced_coverage_for_piece(int piece) {
-        Mask mask = piece_mask(piece);
-        int updated = 0;
-
-        for (int at : PieceIterator(hints_[piece])) {
-            if (!fixed_[at]) {
-                if ((forced_[at] && possible_[at] == mask)) {
-                    updated = 1;
-                    fixed_[at] = mask;
-                    update_not_possible(at, mask, piece);
-                }
-            }
-        }
-
-        return updated;
-    }
-
-    int update_cant_fit_for_piece(int piece) {
-        Mask mask = piece_mask(piece);
-        int size = hints_[piece].second;
-        int valid_o = valid_orientation_[piece];
-        int valid_count = 0;
-        std::array<uint8_t, W*H> count = { 0 };
-
-        if (!valid_o) {
-            return 0;
-        }
-
-        for (int o = 0; o < size * 2; ++o) {
-            if (valid_o & (1 << o)) {
-                bool ok = true;
-                for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                    if (!(possible_[at] & mask)) {
-                        ok = false;
-                    }
-                }
-                if (ok) {
-                    ++valid_count;
-                    for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                        count[at]++;
-                    }
-                }
-            }
-        }
-
-        int updated = 0;
-        for (int at : PieceIterator(hints_[piece])) {
-            if (!fixed_[at]) {
-                if (count[at] == valid_count) {
-                    updated = 1;
-                    fixed_[at] = mask;
-                    update_not_possible(at, mask, piece);
-                }
-            }
-        }
-
-        return updated;
-    }
-
-    void update_not_possible(int update_at, Mask mask, int piece) {
-        int size = hints_[piece].second;
-        int valid_o = valid_orientation_[piece];
-        for (int o = 0; o < size * 2; ++o) {
-            if (valid_o & (1 << o)) {
-                bool no_intersect = true;
-                for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                    if (at == update_at) {
-                        no_intersect = false;
-                    }
-                }
-                if (no_intersect) {
-                    valid_orientation_[piece] &= ~(1 << o);
-                }
-            }
-        }
-    }
-
-    int init_valid_orientations(int piece) {
-        int size = hints_[piece].second;
-        int ret = 0;
-        for (int o = 0; o < size * 2; ++o) {
-            int count = 0;
-            for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                if (!border_[at] &&
-                    (!fixed_[at] || fixed_[at] == piece_mask(piece))) {
-                    ++count;
-                }
-            }
-            bool fit2 = (count == size);
-            if (fit2) {
-                ret |= (1 << o);
-            }
-        }
-        return ret;
-    }
-
-    class PieceOrientationIterator {
-    public:
-        PieceOrientationIterator(Hint piece, int orientation) {
-            int at = piece.first;
-            int size = piece.second;
-            int offset = (size - 1) - (orientation >> 1);
-
-            step_ = ((orientation & 1) ? W : 1);
-            start_ = at - offset * step_;
-            end_ = start_ + size * step_;
-
-            if (start_ < 0 || end_ >= W * H + step_) {
-                start_ = end_ = -1;
-            }
-        }
-
-        struct iterator {
-            iterator(int i, int step) : i_(i), step_(step) {
-            }
-
-            bool operator!=(const iterator& other) const {
-                return i_ != other.i_;
-            }
-
-            int operator*() {
-                return i_;
-            }
-
-            int operator++() {
-                i_ += step_;
-                return i_;
-            }
-
-            int i_, step_;
-        };
-
-        iterator begin() {
-            return iterator(start_, step_);
-        }
-
-        iterator end() {
-            return iterator(end_, step_);
-        }
-
-    private:
-        int start_, end_, step_;
-    };
-
-    class PieceIterator {
-    public:
-        using Indices = std::array<int, 1 + 2*9 + 2*9>;
-
-        PieceIterator(Hint piece) {
-            int at = piece.first;
-            int size = piece.second;
-            is_[size_++] = at;
-
-            int r = at / W;
-            int c = at % W;
-            // The column.
-            for (int ri = std::max(0, r - (size - 1));
-                 ri < std::min(H, r + size);
-                 ++ri) {
-                int at2 = ri * W + c;
-                if (at2 != at)
-                    is_[size_++] = at2;
-            }
-            // The row.
-            for (int ci = std::max(0, c - (size - 1));
-                 ci < std::min(W, c + size);
-                 ++ci) {
-                int at2 = ci + r * W;
-                if (at2 != at)
-                    is_[size_++] = at2;
-            }
-        }
-
-        struct iterator {
-            iterator(int i, Indices* is) : i_(i), is_(is) {
-            }
-
-            bool operator!=(const iterator& other) const {
-                return i_ != other.i_ || is_ != other.is_;
-            }
-
-            int operator*() {
-                return (*is_)[i_];
-            }
-
-            void operator++() {
-                i_++;
-            }
-
-            int i_;
-            Indices* is_;
-        };
-
-        iterator begin() {
-            return iterator(0, &is_);
-        }
-
-        iterator end() {
-            return iterator(size_, &is_);
-        }
-
-    private:
-        int size_ = 0;
-        Indices is_;
-    };
-
-    int update_uncontested_no_cover() {
-        int count = 0;
-        for (int piece = 0; piece < N; ++piece) {
-            int omask = find_uncontested_no_cover(piece);
-            if (!omask)
-                continue;
-            // Found a viable uncontested orientation for the piece.
-            valid_orientation_[piece] = omask;
-            {
-                int o = __builtin_ctzl(omask);
-                for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                    if (!fixed_[at]) {
-                        fixed_[at] = piece_mask(piece);
-                        update_not_possible(at,
-                                            piece_mask(piece),
-                                            piece);
-                    }
-                }
-            }
-            return 1;
-        }
-        return count;
-    }
-
-    int find_uncontested_no_cover(int piece) {
-        // If a piece can't be used to cover any more dots, see if there
-        // are any totally uncontested orientations. If there is one,
-        // just choose it as the actual orientation.
-
-        Mask mask = piece_mask(piece);
-        bool have_contested = false;
-
-        // Bail out early if the piece can still be used to cover a
-        // dot.
-        for (int at : PieceIterator(hints_[piece])) {
-            if (!fixed_[at] && forced_[at] &&
-                (possible_[at] & mask)) {
-                return 0;
-            }
-            if ((possible_[at] & mask) && possible_[at] != mask) {
-                have_contested = true;
-            }
-        }
-
-        // If none of the orientations are contested, this is an
-        // uninteresting case.
-        if (!have_contested) {
-            return 0;
-        }
-
-        // Iterate through all orientations of the piece. Look how many
-        // match orientation A from the intro, how many B/C.
-        int size = hints_[piece].second;
-        int valid_o = valid_orientation_[piece];
-        for (int o = 0; o < size * 2; ++o) {
-            if (valid_o & (1 << o)) {
-                // In this orientation either all squares are already
-                // covered by this piece, or can only be covered by
-                // this piece.
-                bool ok = true;
-                bool non_fixed = false;
-                for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                    if (fixed_[at]) {
-                        if (fixed_[at] != mask)
-                            ok = false;
-                    } else {
-                        non_fixed = true;
-                        if (possible_[at] != mask)
-                            ok = false;
-                    }
-                }
-                if (ok && non_fixed) {
-                    return 1 << o;
-                }
-            }
-        }
-
-        return 0;
-    }
-
-    int update_knowledge_of_single_solution() {
-        int count = 0;
-        for (int piece = 0; piece < N; ++piece) {
-            count += find_knowledge_of_single_solution(piece);
-        }
-        return count;
-    }
-
-    int find_knowledge_of_single_solution(int piece) {
-        // Given a piece P, split the valid orientations into two
-        // groups.  Those where P overlaps with either a dot or a
-        // valid orientation of some other piece (have information),
-        // and those where it doesn't (no information).
-        //
-        // If there are multiple "no information" orientations, a
-        // level generator using a single solution can't possibly
-        // distinguish between them. Any squares covered by all of the
-        // "have information" orientations must therefore be part
-        // of the solution.
-
-        DepMask have_information_union;
-        int have_information_count = 0;
-        int no_information_count = 0;
-
-        // Iterate through all orientations of the piece. Look how many
-        // match orientation A from the intro, how many B/C.
-        int size = hints_[piece].second;
-        int valid_o = valid_orientation_[piece];
-        for (int o = 0; o < size * 2; ++o) {
-            if (valid_o & (1 << o)) {
-                DepMask covered;
-                bool ok = true;
-                bool overlaps_forced = false;
-                bool cant_overlap_with_other_pieces = true;
-                for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                    covered.set(at);
-                    if (!fixed_[at]) {
-                        if (forced_[at])
-                            overlaps_forced = true;
-                        if (possible_count(at) != 1)
-                            cant_overlap_with_other_pieces = false;
-                    } else if (fixed_[at] != piece_mask(piece)) {
-                        ok = false;
-                    }
-                }
-                if (!ok) {
-                    continue;
-                }
-                if (overlaps_forced) {
-                    if (have_information_count++) {
-                        have_information_union &= covered;
-                    } else {
-                        have_information_union = covered;
-                    }
-                } else if (!overlaps_forced &&
-                           cant_overlap_with_other_pieces) {
-                    no_information_count++;
-                }
-            }
-        }
-
-        if (no_information_count > 1) {
-            int update_count = 0;
-            for (int at : PieceIterator(hints_[piece])) {
-                if (fixed_[at])
-                    continue;
-                if (have_information_union[at]) {
-                    fixed_[at] = piece_mask(piece);
-                    update_not_possible(at, piece_mask(piece), piece);
-                    ++update_count;
-                }
-             }
-            return update_count;
-        }
-        return 0;
-    }
-
-    // Find dependencies. E.g.:
-    //
-    //   53.. 4
-    //    5 2
-    //
-    // Above any row that covers the left dot must also cover the right
-    // dot. So the 2 can't go up to cover the right dot.
-    void update_dependent() {
-        for (int at = 0; at < W * H; ++at) {
-            if (!forced_[at])
-                continue;
-            if (fixed_[at])
-                continue;
-            if (possible_count(at) <= 1)
-                continue;
-            DepMask dep;
-            dep.set();
-            for (int piece = 0; piece < N; ++piece) {
-                if (!(piece_mask(piece) & possible_[at]))
-                    continue;
-                dep &= find_dependent(piece, at);
-            }
-            if (dep.count() > 1) {
-                for (int target = 0; target < N; ++target) {
-                    if (dep[target] &&
-                        target != at &&
-                        possible_[at] != possible_[target]) {
-                        if (forced_[target]) {
-                            possible_[target] = possible_[at] =
-                                (possible_[target] & possible_[at]);
-                        }
-                    }
-                }
-            }
-        }
+bool parse_pipeline(const string& pipeline, GeneratorOptions* options) {
+    char rest;
+    if (sscanf(pipeline.c_str(), "%d,%d,%d%c",
+               &options->pipeline_candidate_threads,
+               &options->pipeline_optimize_threads,
+               &options->pipeline_finish_threads, &rest) != 3 ||
+        options->pipeline_candidate_threads <= 0 ||
+        options->pipeline_optimize_threads <= 0 ||
+        options->pipeline_finish_threads <= 0 ||
+        options->pipeline_queue <= 0) {
+        fprintf(stderr, "Invalid --pipeline '%s', expected three thread "
+                "counts C,O,F\n", pipeline.c_str());
+        return false;
     }
-
-    DepMask find_one_of(int piece, int target) {
-        return find_dependent(piece, target, false);
+    if (!options->quotas.empty() || !options->checkpoint_file.empty() ||
+        options->perf_counters) {
+        fprintf(stderr, "--pipeline can't be combined with --quotas, "
+                "--checkpoint_file or --perf_counters\n");
+        return false;
     }
+    return true;
+}
 
-    DepMask find_dependent(int piece, int target,
-                           bool wanted_overlap = true) {
-        Mask mask = piece_mask(piece);
-        int size = hints_[piece].second;
-        int valid_o = valid_orientation_[piece];
-        bool ret_valid;
-        DepMask ret;
-        ret.set();
-
-        for (int o = 0; o < size * 2; ++o) {
-            if (valid_o & (1 << o)) {
-                bool overlaps_target = false;
-                bool ok = true;
-                for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                    if (at == target)
-                        overlaps_target = true;
-                    if (fixed_[at] && fixed_[at] != mask)
-                        ok = false;
-                }
-                if (overlaps_target == wanted_overlap && ok) {
-                    DepMask mask;
-                    for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                        mask[at] = true;
-                    }
-                    ret &= mask;
-                    ret_valid = true;
-                }
-            }
-        }
-
-        if (!ret_valid)
-            ret.reset();
-
-        return ret;
-    }
+int manifest(const GeneratorOptions& base) {
+    string text;
+    std::vector<GenerationJob> jobs;
+    if (!read_file(FLAGS_manifest, &text) ||
+        !parse_manifest(text, FLAGS_puzzledb_dir, &jobs)) {
+        return 1;
+    }
+    ManifestOptions options;
+    options.base = base;
+    options.runs_per_job = std::max(1, FLAGS_manifest_runs);
+    options.threads = FLAGS_threads;
+    options.work_dir = FLAGS_manifest_work_dir.empty() ?
+        FLAGS_puzzledb_dir + ".work" : FLAGS_manifest_work_dir;
+    return run_manifest(jobs, options);
+}
 
-    //      Y   5
-    //    X 4   Z
-    //
-    // 4 needs to cover either Y or Z, so can't cover X.
-    void update_square() {
-        for (int piece = 0; piece < N; ++piece) {
-            int size = hints_[piece].second;
-            std::vector<int> covered;
-            for (int at : PieceIterator(hints_[piece])) {
-                if (!forced_[at] || fixed_[at] ||
-                    possible_count(at) != 2)
-                    continue;
-                if (!(possible_[at] & piece_mask(piece)))
-                    continue;
-                covered.push_back(at);
-            }
-            // Find pairs of squares where:
-            // - Both can be covered by the candidate and one other
-            //   piece (the same in both cases).
-            // - The candidate piece can't cover both squares at the same
-            //   time. (That will implicitly mean that the other piece
-            //   can't do it either).
-            for (int i = 0; i < covered.size(); ++i) {
-                for (int j = i + 1; j < covered.size(); ++j) {
-                    int ai = covered[i], aj = covered[j];
-                    if (distance(ai, aj) <= size)
-                        continue;
-                    Mask pi = possible_[ai], pj = possible_[aj];
-                    if (pi != pj)
-                        continue;
-                    // Remove any orientations of the piece that
-                    // don't cover at least one of the two squares.
-                    int valid_o = valid_orientation_[piece];
-                    for (int o = 0; o < size * 2; ++o) {
-                        if (valid_o & (1 << o)) {
-                            bool no_candidate = true;
-                            for (int at :
-                                 PieceOrientationIterator(hints_[piece], o)) {
-                                if (at == ai || at == aj)
-                                    no_candidate = false;
-                            }
-                            if (no_candidate) {
-                                valid_orientation_[piece] &= ~(1 << o);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
+GeneratorOptions options_from_flags() {
+    GeneratorOptions options;
+    options.seed = FLAGS_seed;
+    options.puzzle_count = FLAGS_puzzle_count;
+    options.optimize_iterations = FLAGS_optimize_iterations;
+    options.solve_progress_file = FLAGS_solve_progress_file;
+    options.candidate_progress_file = FLAGS_candidate_progress_file;
+    options.score_cover = FLAGS_score_cover;
+    options.score_cant_fit = FLAGS_score_cant_fit;
+    options.score_square = FLAGS_score_square;
+    options.score_dep = FLAGS_score_dep;
+    options.score_one_of = FLAGS_score_one_of;
+    options.score_max_width = FLAGS_score_max_width;
+    options.score_single_solution = FLAGS_score_single_solution;
+    options.score_uncontested_no_cover = FLAGS_score_uncontested_no_cover;
+    options.quotas = FLAGS_quotas;
+    options.quota_max_puzzles = FLAGS_quota_max_puzzles;
+    options.quota_max_misses = FLAGS_quota_max_misses;
+    options.quota_steer_weight = FLAGS_quota_steer_weight;
+    options.collection_score = FLAGS_collection_score;
+    options.dedup = FLAGS_dedup;
+    options.dedup_against = FLAGS_dedup_against;
+    options.output_file = FLAGS_output_file;
+    options.checkpoint_file = FLAGS_checkpoint_file;
+    options.resume = FLAGS_resume;
+    options.checkpoint_interval_s = FLAGS_checkpoint_interval_s;
+    options.output_batch = FLAGS_output_batch;
+    options.time_budget_ms = FLAGS_time_budget_ms;
+    options.run_time_budget_ms = FLAGS_run_time_budget_ms;
+    options.max_candidate_attempts = FLAGS_max_candidate_attempts;
+    options.max_candidate_retries = FLAGS_max_candidate_retries;
+    options.fast_reject = FLAGS_fast_reject;
+    options.fast_reject_min_overlap = FLAGS_fast_reject_min_overlap;
+    options.constructive = FLAGS_constructive;
+    options.perf_counters = FLAGS_perf_counters;
+    options.adaptive_mutation = FLAGS_adaptive_mutation;
+    options.pareto_archive = FLAGS_pareto_archive;
+    options.archive_epsilon = FLAGS_archive_epsilon;
+    options.plateau_iterations = FLAGS_plateau_iterations;
+    options.plateau_restarts = FLAGS_plateau_restarts;
+    options.pipeline_queue = FLAGS_pipeline_queue;
+    return options;
+}
 
-    // Find dependencies. E.g.:
-    //
-    //----
-    //  y2
-    //  3.
-    //  Y2
-    // ---
-    //
-    // Both 2s can't be vertical, so either Y or y must be
-    // filled. So 3 must be horizontal.
-    void update_one_of() {
-        for (int at = 0; at < W * H; ++at) {
-            // Find squares where two pieces on the same
-            // row / column can intersect.
-            if (fixed_[at])
-                continue;
-            if (possible_count(at) < 2)
-                continue;
-            int piece_a = 0, piece_b = 0;
-            // This is slightly suboptimal that it'll only
-            // find one pair of potential a / b piece, not
-            // pairs.
-            if (!find_pieces_on_same_row_or_column(at,
-                                                   &piece_a,
-                                                   &piece_b))
-                continue;
-            // For each of those two pieces, find the set of squares
-            // that they must pass through if they don't go through
-            // the intersecting square.
-            DepMask a = find_one_of(piece_a, at);
-            DepMask b = find_one_of(piece_b, at);
-            Mask target_pieces_a = 0;
-            Mask target_pieces_b = 0;
-            // Then see if there exists a piece that could
-            // intersect with both of the above sets.
-            for (int target = 0; target < W * H; ++target) {
-                if (!a[target] && !b[target])
-                    continue;
-                for (int piece = 0; piece < N; ++piece) {
-                    if (piece == piece_a || piece == piece_b)
-                        continue;
-                    if (piece_mask(piece) & possible_[target]) {
-                        if (a[target])
-                            target_pieces_a |= piece_mask(piece);
-                        if (b[target])
-                            target_pieces_b |= piece_mask(piece);
-                    }
-                }
-            }
-            Mask target_pieces_both = target_pieces_a &
-                target_pieces_b;
-            if (target_pieces_both) {
-                // If such a piece exists, check if the piece
-                // can intersect with both sets at the same time.
-                // If it can, exclude any such orientations.
-                for (int piece = 0; piece < N; ++piece) {
-                    if (piece_mask(piece) & target_pieces_both) {
-                        exclude_if_in_both_sets(piece, a, b);
-                    }
-                }
-            }
-        }
+int main(int argc, char** argv) {
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    GeneratorOptions options = options_from_flags();
+    if (!parse_disabled_rules(FLAGS_disable_rules, &options)) {
+        return 1;
     }
 
-    bool find_pieces_on_same_row_or_column(int at, int* a, int* b) {
-        int possible = possible_[at];
-        for (int i = 0; i < N; ++i) {
-            if (!(possible & piece_mask(i)))
-                continue;
-            for (int j = i + 1; j < N; ++j) {
-                if (!(possible & piece_mask(j)))
-                    continue;
-                int a_at = hints_[i].first;
-                int b_at = hints_[j].first;
-                if ((a_at / W == b_at / W) ||
-                    (a_at % W == b_at % W)) {
-                    *a = i;
-                    *b = j;
-                    return true;
-                }
-            }
-        }
-
-        return false;
+    if (FLAGS_build_collection) {
+        return collection();
     }
 
-    void exclude_if_in_both_sets(int piece,
-                                 const DepMask& a,
-                                 const DepMask& b) {
-        Mask mask = piece_mask(piece);
-        int size = hints_[piece].second;
-        int valid_o = valid_orientation_[piece];
-
-        for (int o = 0; o < size * 2; ++o) {
-            if (valid_o & (1 << o)) {
-                bool a_hit = false, b_hit = false;
-                bool ok = true;
-                for (int at : PieceOrientationIterator(hints_[piece], o)) {
-                    if (a[at]) a_hit = true;
-                    if (b[at]) b_hit = true;
-                    if (fixed_[at] && fixed_[at] != mask) {
-                        ok = false;
-                    }
-                }
-                if (ok && a_hit && b_hit) {
-                    valid_orientation_[piece] &= ~(1 << o);
-                }
-            }
-        }
+    if (FLAGS_dedup_puzzledb) {
+        return dedup_puzzledb(FLAGS_puzzledb_dir + "/*");
     }
 
-    int distance(int a, int b) {
-        int ra = a / W, rb = b / W,
-            ca = a % W, cb = b % W;
-        int rd = std::abs(ra - rb), cd = std::abs(ca - cb);
-        if (rd && cd) {
-            return W + H + 1;
-        }
-        return rd + cd;
+    if (!FLAGS_merge_shards.empty()) {
+        return merge_shards(FLAGS_merge_shards, FLAGS_dedup, stdout);
     }
 
-    std::array<Hint, N> hints_;
-    uint16_t valid_orientation_[N] { 0 };
-    MaskArray orig_possible_;
-    MaskArray possible_ = { 0 };
-    MaskArray fixed_ = { 0 };
-    bool forced_[H * W] = { 0 };
-    bool border_[H * W] = { 0 };
-};
-
-Game add_forced_squares(Game game, FILE* fp) {
-    if (fp)
-        game.print_json(fp, "");
-    for (int i = 0; i < 100; ++i) {
-        if (game.force_if_uncontested() && fp)
-            game.print_json(fp, "\"type\":\"ambiguate\",");
-        auto res = game.iterate();
-        if (res.first == DeductionKind::NONE) {
-            if (!game.force_one_square()) {
-                break;
-            }
-            if (fp)
-                game.print_json(fp, "\"type\":\"add dot\",");
-        } else {
-            if (fp)
-                game.print_json(fp, "");
-        }
-        if (game.impossible()) {
-            break;
-        }
-        // game.print_puzzle(false);
+    if (!FLAGS_solve.empty()) {
+        return run_solve(FLAGS_solve, options, stdout);
     }
 
-    return game;
-}
-
-struct SolutionMetaData {
-    int depth = 0;
-    int max_width = 0;
-
-    void print(const string& prefix, const string& suffix) {
-        printf("%s", prefix.c_str());
-
-        printf("\"depth\": %d, ", depth);
-        printf("\"max_width\": %d", max_width);
-
-        printf("%s", suffix.c_str());
+    if (!FLAGS_verify_db.empty()) {
+        VerifyOptions verify;
+        verify.pattern = FLAGS_verify_db;
+        verify.golden = FLAGS_verify_golden;
+        verify.update_golden = FLAGS_verify_update_golden;
+        verify.rate_file = FLAGS_verify_rate_file;
+        verify.max_slowdown = FLAGS_verify_max_slowdown;
+        verify.threads = FLAGS_threads;
+        return run_verify_db(verify, stdout);
     }
-};
-
-struct Classification {
-    SolutionMetaData all;
-    SolutionMetaData one_of;
-    SolutionMetaData dep;
-    SolutionMetaData square;
-    SolutionMetaData cant_fit;
-    SolutionMetaData cover;
-    SolutionMetaData single_solution;
-    SolutionMetaData uncontested_no_cover;
-
-    bool solved = false;
 
-    void print(const string& prefix, const string& suffix) {
-        printf("%s", prefix.c_str());
-
-        all.print("\"all\": {", "}, ");
-        one_of.print("\"one_of\": {", "}, ");
-        dep.print("\"dep\": {", "}, ");
-        square.print("\"square\": {", "}, ");
-        cant_fit.print("\"cant_fit\": {", "}, ");
-        cover.print("\"cover\": {", "},");
-        single_solution.print("\"single-solution\": {", "},");
-        uncontested_no_cover.print("\"uncontested-no-cover\": {", "}");
-        printf("%s", suffix.c_str());
+    if (FLAGS_benchmark_iterations) {
+        return run_benchmark(FLAGS_benchmark_iterations, options, stdout);
     }
-};
-
-Classification classify_game(Game game,
-                             FILE* print_progress=NULL) {
-    Classification ret;
-
-    game.reset_hints();
-    const char* extra_json = "";
-
-    for (int i = 0; ; ++i) {
-        if (print_progress) {
-            game.print_json(print_progress, extra_json);
-        }
-
-        auto res = game.iterate();
-        switch (res.first) {
-        case DeductionKind::NONE:
-            return ret;
-        case DeductionKind::COVER:
-            extra_json = "\"type\":\"cover\",";
-            ret.cover.depth++;
-            ret.cover.max_width = std::max(ret.cover.max_width,
-                                           res.second);
-            break;
-        case DeductionKind::CANT_FIT:
-            extra_json = "\"type\":\"fit\",";
-            ret.cant_fit.depth++;
-            ret.cant_fit.max_width = std::max(ret.cant_fit.max_width,
-                                              res.second);
-            break;
-        case DeductionKind::SQUARE:
-            extra_json = "\"type\":\"square\",";
-            ret.square.depth++;
-            ret.square.max_width = std::max(ret.square.max_width,
-                                            res.second);
-            break;
-        case DeductionKind::DEPENDENCY:
-            extra_json = "\"type\":\"dep\",";
-            ret.dep.depth++;
-            ret.dep.max_width = std::max(ret.dep.max_width,
-                                         res.second);
-            break;
-        case DeductionKind::ONE_OF:
-            extra_json = "\"type\":\"oneof\",";
-            ret.one_of.depth++;
-            ret.one_of.max_width = std::max(ret.one_of.max_width,
-                                           res.second);
-            break;
-        case DeductionKind::SINGLE_SOLUTION:
-            extra_json = "\"type\":\"single-solution\",";
-            ret.single_solution.depth++;
-            ret.single_solution.max_width =
-                std::max(ret.single_solution.max_width,
-                         res.second);
-            break;
-        case DeductionKind::UNCONTESTED_NO_COVER:
-            extra_json = "\"type\":\"uncontested-no-cover\",";
-            ret.uncontested_no_cover.depth++;
-            ret.uncontested_no_cover.max_width =
-                std::max(ret.uncontested_no_cover.max_width,
-                         res.second);
-            break;
-        }
-        ret.all.depth++;
-        ret.all.max_width = std::max(ret.all.max_width,
-                                     res.second);
-
-        if (game.solved()) {
-            if (print_progress) {
-                game.print_json(print_progress, extra_json);
-            }
-            ret.solved = true;
-            break;
-        }
 
-        if (game.impossible()) {
-            break;
-        }
+    if (FLAGS_differential) {
+        return run_differential(FLAGS_differential_random,
+                                FLAGS_puzzledb_dir + "/*", options, stdout);
     }
 
-    return ret;
-}
-
-Game mutate(Game game) {
-    // game.reset_fixed();
-    game.reset_forced();
-    game.mutate();
-
-    return game;
-}
-
-struct OptimizationResult {
-    OptimizationResult(Game game, Classification cls)
-        : game(game), cls(cls) {
-        score =
-            (cls.cover.depth * FLAGS_score_cover) +
-            (cls.cant_fit.depth * FLAGS_score_cant_fit) +
-            (cls.square.depth * FLAGS_score_square) +
-            (cls.dep.depth * FLAGS_score_dep) +
-            (cls.one_of.depth * FLAGS_score_one_of) +
-            (cls.single_solution.depth * FLAGS_score_single_solution) +
-            (cls.uncontested_no_cover.depth * FLAGS_score_uncontested_no_cover) +
-            (cls.all.max_width * FLAGS_score_max_width);
+    if (!FLAGS_solution_space.empty()) {
+        return run_solution_space(FLAGS_solution_space,
+                                  FLAGS_solution_space_max_nodes, stdout);
     }
 
-    Game game;
-    Classification cls;
-    int score;
-};
-
-Game minimize_width(Game game) {
-    const int N = FLAGS_optimize_iterations;
-    if (!N)
-        return game;
-
-    struct Cmp {
-        bool operator() (const OptimizationResult& a,
-                         const OptimizationResult& b) {
-            return b.score < a.score;
-        }
-    };
-
-    FILE* fp = nullptr;
-    if (!FLAGS_solve_progress_file.empty()) {
-        fp = fopen(FLAGS_solve_progress_file.c_str(), "w");
+    if (FLAGS_hint_server) {
+        return run_hint_server(stdin, stdout);
     }
 
-    std::vector<OptimizationResult> res;
-    res.emplace_back(game, classify_game(game));
-
-    char buf[256];
-    auto extra_json = [&] (int iter, int score) {
-        sprintf(buf, "\"score\":%d,\"iter\":%d,", score, iter);
-        return buf;
-    };
-    if (fp) {
-        game.print_json(fp, extra_json(0, res[0].score));
+    if (!FLAGS_select_from_archive.empty()) {
+        return run_select_from_archive(FLAGS_select_from_archive, options,
+                                       stdout);
     }
 
-    for (int i = 0; i < N; ++i) {
-        auto base = res[rand() % res.size()];
-        Game opt = mutate(base.game);
-        opt = add_forced_squares(opt, NULL);
-        OptimizationResult opt_res(opt, classify_game(opt));
-
-        if (opt_res.cls.solved) {
-            // if (opt_res.score > res[0].score) {
-            //     fprintf(stderr, "%d: %d\n", i, res[0].score);
-            // }
-            res.push_back(opt_res);
-            if (fp &&
-                opt_res.score > res[0].score) {
-                opt.print_json(fp, extra_json(i, res[0].score));
-            }
-            sort(res.begin(), res.end(), Cmp());
-            if (res.size() > 10) {
-                res.pop_back();
-            }
-        }
+    stop_on_signals();
+    if (!FLAGS_manifest.empty()) {
+        return manifest(options);
     }
-    // fprintf(stderr, "---\n");
-
-    return res[0].game;
-}
-
-Game optimize_game(Game game) {
-    Classification cls = classify_game(game);
-
-    Game opt = minimize_width(game);
-    Classification opt_cls = classify_game(opt);
-
-    fprintf(stderr,
-            "%d/%d [%d/%d/%d/%d/%d/%d/%d] -> %d/%d "
-            "[%d/%d/%d/%d/%d/%d/%d]\n",
-            cls.all.max_width,
-            cls.all.depth,
-            cls.one_of.depth,
-            cls.dep.depth,
-            cls.square.depth,
-            cls.cant_fit.depth,
-            cls.cover.depth,
-            cls.single_solution.depth,
-            cls.uncontested_no_cover.depth,
-            opt_cls.all.max_width,
-            opt_cls.all.depth,
-            opt_cls.one_of.depth,
-            opt_cls.dep.depth,
-            opt_cls.square.depth,
-            opt_cls.cant_fit.depth,
-            opt_cls.cover.depth,
-            opt_cls.single_solution.depth,
-            opt_cls.uncontested_no_cover.depth);
-
-    return opt;
-}
 
-
-// Find a game with the given parameters that can be solved.
-Game create_candidate_game() {
-
-    for (int i = 0; i < 1000000; ++i) {
-        FILE* fp = nullptr;
-        if (!FLAGS_candidate_progress_file.empty()) {
-            fp = fopen(FLAGS_candidate_progress_file.c_str(), "w");
-        }
-
-        Game game;
-        game = add_forced_squares(game, fp);
-        if (fp)
-            fclose(fp);
-
-        if (game.solved()) {
-            Classification cls = classify_game(game);
-            if (!cls.solved) {
-                continue;
-            }
-            if ((FLAGS_score_square > 0 || FLAGS_score_dep > 0 ||
-                 FLAGS_score_one_of > 0) &&
-                (cls.square.depth == 0 &&
-                 cls.one_of.depth == 0 &&
-                 cls.dep.depth == 0)) {
-                continue;
-            }
-            return game;
-        }
+    if (!FLAGS_shard.empty() && !parse_shard(FLAGS_shard, &options)) {
+        return 1;
     }
 
-    assert(false);
-}
-
-int solve(const std::string& puzzle) {
-    Game game(puzzle);
-    FILE* fp = NULL;
-    if (!FLAGS_solve_progress_file.empty()) {
-        fp = fopen(FLAGS_solve_progress_file.c_str(), "w");
+    if (!FLAGS_pipeline.empty() && !parse_pipeline(FLAGS_pipeline, &options)) {
+        return 1;
     }
-    Classification cls = classify_game(game, fp);
 
-    printf("{ \"puzzle\": [");
-    game.print_puzzle(true);
-    cls.print("], \"classification\": {", "}");
-    printf("}\n");
-
-    return 0;
-}
-
-int main(int argc, char** argv) {
-    google::ParseCommandLineFlags(&argc, &argv, true);
-    srand(FLAGS_seed);
-
-    if (!FLAGS_solve.empty()) {
-        return solve(FLAGS_solve);
+    if (!FLAGS_checkpoint_file.empty() && FLAGS_output_file.empty()) {
+        fprintf(stderr, "--checkpoint_file requires --output_file\n");
+        return 1;
     }
 
-    for (int j = 0; j < FLAGS_puzzle_count; ++j) {
-        Game game = create_candidate_game();
-        Game opt = optimize_game(game);
-        Classification cls = classify_game(opt);
+    GeneratorResult result;
+    bool ok = run_generator(BoardSize { MAP_HEIGHT, MAP_WIDTH, PIECES },
+                            options, &result);
+    write_stats(result);
 
-        printf("{ \"puzzle\": [");
-        opt.print_puzzle(true);
-        cls.print("], \"classification\": {", "}");
-        printf("}\n");
-    }
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,590 @@
+#include "modes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "generator.h"
+#include "hint.h"
+#include "linjat.h"
+#include "puzzledb.h"
+#include "reference_game.h"
+#include "solution_space.h"
+
+using std::string;
+
+namespace {
+
+// The board size given with -DMAP_HEIGHT, -DMAP_WIDTH and -DPIECES.
+using DefaultGame = Game<MAP_HEIGHT, MAP_WIDTH, PIECES>;
+using DefaultReferenceGame = ReferenceGame<MAP_HEIGHT, MAP_WIDTH, PIECES>;
+
+// The puzzle in the format of --solve. Returns false if it isn't a
+// valid puzzle of the compiled-in size.
+bool solve_string(const std::vector<string>& rows, string* map) {
+    BoardSize size;
+    return parse_puzzle(rows, &size, map) &&
+        size.height == DefaultGame::H && size.width == DefaultGame::W - 1 &&
+        size.pieces == DefaultGame::N && DefaultGame::valid_map(*map);
+}
+
+}
+
+int run_solve(const string& map, const GeneratorOptions& options,
+              FILE* out) {
+    if (!DefaultGame::valid_map(map)) {
+        fprintf(stderr, "Invalid puzzle, expected a %dx%d puzzle with %d "
+                "hints\n", DefaultGame::H, DefaultGame::W - 1, DefaultGame::N);
+        return 1;
+    }
+    generator_options = options;
+    DefaultGame game(map);
+    FILE* fp = NULL;
+    if (!options.solve_progress_file.empty()) {
+        fp = fopen(options.solve_progress_file.c_str(), "w");
+    }
+    Classification cls = classify_game(game, fp);
+
+    print_puzzle_record(game, cls, "", out);
+
+    return 0;
+}
+
+int run_verify_db(const VerifyOptions& options, FILE* out) {
+    struct Puzzle {
+        string file;
+        int index;
+        BoardSize size;
+        // In the format of --solve.
+        string map;
+        string expected;
+    };
+    std::vector<Puzzle> puzzles;
+    std::map<string, int> file_puzzles;
+    int64_t skipped = 0;
+
+    PuzzleReader reader(options.pattern);
+    PuzzleRecord record;
+    while (reader.next(&record)) {
+        int index = file_puzzles[reader.file()]++;
+        BoardSize size;
+        string map;
+        if (!parse_puzzle(record.puzzle, &size, &map) ||
+            !supported_size(size)) {
+            ++skipped;
+            continue;
+        }
+        puzzles.push_back(Puzzle { reader.file(), index, size, map,
+                                   record.cls.compact() });
+    }
+
+    if (!options.golden.empty() && !options.update_golden) {
+        string golden;
+        if (!read_file(options.golden, &golden)) {
+            return 1;
+        }
+        size_t i = 0, start = 0;
+        while (start < golden.size()) {
+            size_t end = std::min(golden.find('\n', start), golden.size());
+            string line = golden.substr(start, end - start);
+            start = end + 1;
+            if (i < puzzles.size()) {
+                puzzles[i++].expected = line;
+            } else {
+                ++i;
+            }
+        }
+        if (i != puzzles.size()) {
+            fprintf(stderr, "%s has %zu classifications, expected %zu\n",
+                    options.golden.c_str(), i, puzzles.size());
+            return 1;
+        }
+    }
+
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // A single pass over a file takes well under a second, too short
+    // for a stable throughput, so the workers keep going round the
+    // puzzles until this long has passed. The throughput is per
+    // thread, so that it doesn't depend on the number of cores.
+    const double min_seconds = 1;
+    using Clock = std::chrono::steady_clock;
+    std::vector<string> actual(puzzles.size());
+    std::atomic<size_t> next(0);
+    auto start = Clock::now();
+    auto elapsed = [&start] () {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads && !puzzles.empty(); ++t) {
+        workers.emplace_back([&] () {
+                Classification cls;
+                for (size_t i; (i = next++) < puzzles.size() ||
+                         elapsed() < min_seconds; ) {
+                    const Puzzle& puzzle = puzzles[i % puzzles.size()];
+                    if (solve_puzzle(puzzle.size, puzzle.map, &cls) &&
+                        i < puzzles.size()) {
+                        actual[i] = cls.compact();
+                    }
+                }
+            });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = elapsed();
+    // The last index handed out by each worker wasn't solved.
+    size_t solved = puzzles.empty() ? 0 : next - threads;
+    double rate = seconds > 0 ? solved / seconds / threads : 0;
+
+    int64_t mismatches = 0;
+    if (options.update_golden) {
+        FILE* fp = fopen(options.golden.c_str(), "w");
+        if (!fp) {
+            perror(options.golden.c_str());
+            return 1;
+        }
+        for (const auto& cls : actual) {
+            fprintf(fp, "%s\n", cls.c_str());
+        }
+        fclose(fp);
+    } else {
+        for (int i = 0; i < puzzles.size(); ++i) {
+            if (actual[i] == puzzles[i].expected) {
+                continue;
+            }
+            if (++mismatches <= 20) {
+                fprintf(stderr, "%s:%d: expected '%s', got '%s'\n",
+                        puzzles[i].file.c_str(), puzzles[i].index,
+                        puzzles[i].expected.c_str(), actual[i].c_str());
+            }
+        }
+    }
+
+    // Absolute throughput depends on the machine, so it's only ever
+    // compared with an earlier run kept outside the source tree.
+    double baseline_rate = 0;
+    if (!options.rate_file.empty()) {
+        if (FILE* fp = fopen(options.rate_file.c_str(), "r")) {
+            if (fscanf(fp, "%lf", &baseline_rate) != 1) {
+                baseline_rate = 0;
+            }
+            fclose(fp);
+        } else if (FILE* fp = fopen(options.rate_file.c_str(), "w")) {
+            fprintf(fp, "%.1f\n", rate);
+            fclose(fp);
+        } else {
+            perror(options.rate_file.c_str());
+            return 1;
+        }
+    }
+    bool too_slow = options.max_slowdown > 0 && baseline_rate > 0 &&
+        rate < baseline_rate * (1 - options.max_slowdown);
+    fprintf(out, "{\"puzzles\": %zu, \"skipped\": %ld, \"mismatches\": %ld, "
+            "\"threads\": %d, \"seconds\": %.3f, "
+            "\"puzzles_per_thread_s\": %.1f, "
+            "\"baseline_puzzles_per_thread_s\": %.1f, "
+            "\"too_slow\": %s}\n",
+            puzzles.size(), skipped, mismatches, threads, seconds, rate,
+            baseline_rate, too_slow ? "true" : "false");
+
+    return (mismatches || too_slow) ? 1 : 0;
+}
+
+namespace {
+
+// Solve the puzzle with both Game and ReferenceGame, comparing the
+// deduction and the state after each step. Returns false, after
+// printing what differed, on the first difference.
+bool solve_differential(const string& map, int64_t* steps,
+                        double* game_ns, double* reference_ns) {
+    using Clock = std::chrono::steady_clock;
+    using std::chrono::duration;
+    DefaultGame game(map);
+    DefaultReferenceGame reference(map);
+    for (int step = 1; ; ++step) {
+        auto start = Clock::now();
+        auto result = game.iterate();
+        auto middle = Clock::now();
+        auto reference_result = reference.iterate();
+        auto end = Clock::now();
+        *game_ns += duration<double, std::nano>(middle - start).count();
+        *reference_ns += duration<double, std::nano>(end - middle).count();
+        ++*steps;
+
+        string difference;
+        char buf[128];
+        if (result != reference_result) {
+            snprintf(buf, sizeof(buf), "deduction %d/%d vs. %d/%d",
+                     result.first, result.second,
+                     reference_result.first, reference_result.second);
+            difference = buf;
+        }
+        for (int at = 0; at < DefaultGame::W * DefaultGame::H &&
+                 difference.empty(); ++at) {
+            if (game.fixed_piece(at) != reference.fixed_piece(at)) {
+                snprintf(buf, sizeof(buf), "square r=%d c=%d fixed to "
+                         "piece %d vs. %d", at / DefaultGame::W,
+                         at % DefaultGame::W - 1, game.fixed_piece(at),
+                         reference.fixed_piece(at));
+                difference = buf;
+            }
+        }
+        for (int piece = 0; piece < DefaultGame::N &&
+                 difference.empty(); ++piece) {
+            if (game.valid_orientations(piece) !=
+                reference.valid_orientations(piece)) {
+                snprintf(buf, sizeof(buf), "piece %d orientations "
+                         "%#x vs. %#x", piece,
+                         game.valid_orientations(piece),
+                         reference.valid_orientations(piece));
+                difference = buf;
+            }
+        }
+        if (!difference.empty()) {
+            fprintf(stderr, "Game and ReferenceGame differ after step %d: "
+                    "%s\nReproduce with --solve='%s'\n", step,
+                    difference.c_str(), map.c_str());
+            return false;
+        }
+        if (result.first == DeductionKind::NONE) {
+            return true;
+        }
+    }
+}
+
+}
+
+int run_differential(int random_puzzles, const string& puzzledb_pattern,
+                     const GeneratorOptions& options, FILE* out) {
+    generator_options = options;
+    if (!reset_generator()) {
+        return 1;
+    }
+    int64_t random = 0, puzzledb = 0, skipped = 0, steps = 0;
+    double game_ns = 0, reference_ns = 0;
+    bool ok = true;
+    string map;
+    for (int i = 0; ok && i < random_puzzles; ++i) {
+        auto game = create_candidate_game<DefaultGame>();
+        if (!game) {
+            fprintf(stderr, "No solvable candidate found\n");
+            return 1;
+        }
+        solve_string(game->puzzle_rows(), &map);
+        ok = solve_differential(map, &steps, &game_ns, &reference_ns);
+        ++random;
+    }
+
+    PuzzleReader reader(puzzledb_pattern);
+    PuzzleRecord record;
+    while (ok && reader.next(&record)) {
+        if (!solve_string(record.puzzle, &map)) {
+            ++skipped;
+            continue;
+        }
+        ok = solve_differential(map, &steps, &game_ns, &reference_ns);
+        ++puzzledb;
+    }
+
+    fprintf(out, "{\"random\": %ld, \"puzzledb\": %ld, \"skipped\": %ld, "
+            "\"steps\": %ld, \"game_steps_per_s\": %.1f, "
+            "\"reference_steps_per_s\": %.1f, \"speedup\": %.2f, "
+            "\"agree\": %s}\n",
+            random, puzzledb, skipped, steps,
+            game_ns > 0 ? steps * 1e9 / game_ns : 0.0,
+            reference_ns > 0 ? steps * 1e9 / reference_ns : 0.0,
+            game_ns > 0 ? reference_ns / game_ns : 0.0,
+            ok ? "true" : "false");
+    return ok ? 0 : 1;
+}
+
+namespace {
+
+// Parse the "lines" of a --hint_server request.
+bool parse_player_lines(const string& json, std::vector<PlayerLine>* lines) {
+    std::vector<string> values, coords;
+    if (!json_array_values(json, &values)) {
+        return false;
+    }
+    lines->clear();
+    for (const auto& value : values) {
+        if (!json_array_values(value, &coords) || coords.size() != 6) {
+            return false;
+        }
+        int c[6];
+        for (int i = 0; i < 6; ++i) {
+            c[i] = atoi(coords[i].c_str());
+        }
+        lines->push_back(PlayerLine { c[0], c[1], c[2], c[3], c[4], c[5] });
+    }
+    return true;
+}
+
+void print_next_hint(const NextHint& hint, FILE* out) {
+    auto print_square = [out] (int at) {
+        fprintf(out, "\"r\": %d, \"c\": %d", at / DefaultGame::W,
+                at % DefaultGame::W - 1);
+    };
+    fprintf(out, "\"solved\": %s, \"contradictions\": [",
+            hint.solved ? "true" : "false");
+    for (int i = 0; i < hint.contradictions.size(); ++i) {
+        fprintf(out, "%s{\"line\": %d, \"reason\": \"%s\"}", i ? ", " : "",
+                hint.contradictions[i].first, hint.contradictions[i].second);
+    }
+    fprintf(out, "], \"kind\": \"%s\", \"width\": %d, \"pieces\": [",
+            deduction_name(hint.kind), hint.width);
+    for (int i = 0; i < hint.pieces.size(); ++i) {
+        fprintf(out, "%s{", i ? ", " : "");
+        print_square(hint.pieces[i].first);
+        fprintf(out, ", \"cells\": [");
+        const auto& cells = hint.pieces[i].second;
+        for (int j = 0; j < cells.size(); ++j) {
+            fprintf(out, "%s{", j ? ", " : "");
+            print_square(cells[j]);
+            fprintf(out, "}");
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "]");
+}
+
+}
+
+// The solution of each puzzle is worked out the first time it is seen
+// and kept, so the answers only cost one solver step. Responses are in
+// the order of the requests, and carry along any "id" of the request.
+int run_hint_server(FILE* in, FILE* out) {
+    using Engine = HintEngine<DefaultGame>;
+    // Bounded so that a long-running server doesn't grow without limit.
+    const size_t max_engines = 10000;
+    std::map<string, std::unique_ptr<Engine>> engines;
+    char* buf = nullptr;
+    size_t buf_size = 0;
+    ssize_t len;
+    while ((len = getline(&buf, &buf_size, in)) > 0) {
+        auto start = std::chrono::steady_clock::now();
+        string request(buf, len);
+        string id, puzzle, lines_json, map;
+        std::vector<string> rows;
+        std::vector<PlayerLine> lines;
+        bool has_id = json_object_value(request, "id", &id);
+        fprintf(out, "{");
+        if (has_id) {
+            fprintf(out, "\"id\": %s, ", id.c_str());
+        }
+        if (!json_object_value(request, "puzzle", &puzzle) ||
+            !json_array_values(puzzle, &rows) ||
+            !json_object_value(request, "lines", &lines_json) ||
+            !parse_player_lines(lines_json, &lines)) {
+            fprintf(out, "\"error\": \"malformed request\"}\n");
+            fflush(out);
+            continue;
+        }
+        for (auto& row : rows) {
+            row = json_unquote(row);
+        }
+        if (!solve_string(rows, &map)) {
+            fprintf(out, "\"error\": "
+                    "\"not a valid %dx%d puzzle with %d hints\"}\n",
+                    DefaultGame::H, DefaultGame::W - 1, DefaultGame::N);
+            fflush(out);
+            continue;
+        }
+
+        auto it = engines.find(map);
+        if (it == engines.end()) {
+            if (engines.size() >= max_engines) {
+                engines.clear();
+            }
+            it = engines.emplace(map, std::unique_ptr<Engine>(
+                                     new Engine(map))).first;
+        }
+        NextHint hint = it->second->next(lines);
+        print_next_hint(hint, out);
+        double us = std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count();
+        fprintf(out, ", \"us\": %.1f}\n", us);
+        fflush(out);
+    }
+    free(buf);
+    return 0;
+}
+
+// Each puzzle is printed with its ambiguity map: the number of pieces
+// that cover each square in some solution.
+int run_solution_space(const string& pattern, int64_t max_nodes,
+                       FILE* out) {
+    PuzzleReader reader(pattern);
+    PuzzleRecord record;
+    int64_t puzzles = 0, skipped = 0, unique = 0, incomplete = 0;
+    auto start = std::chrono::steady_clock::now();
+    string map;
+    while (reader.next(&record)) {
+        if (!solve_string(record.puzzle, &map)) {
+            ++skipped;
+            continue;
+        }
+        ++puzzles;
+        DefaultGame game(map);
+        SolutionSpace<DefaultGame> space(game);
+        auto result = space.analyze(max_nodes);
+        unique += result.complete && result.solutions == 1;
+        incomplete += !result.complete;
+
+        fprintf(out, "{\"puzzle\": [");
+        game.print_puzzle(true, out);
+        fprintf(out, "], \"solutions\": %lu, \"components\": %d, "
+                "\"nodes\": %ld, \"complete\": %s, \"ambiguity\": [",
+                result.solutions, result.components, result.nodes,
+                result.complete ? "true" : "false");
+        for (int r = 0; r < DefaultGame::H; ++r) {
+            string row;
+            for (int c = 1; c < DefaultGame::W; ++c) {
+                int count = 0;
+                for (const auto& cover : result.cover) {
+                    count += cover[r * DefaultGame::W + c];
+                }
+                row += count > 9 ? '+' : '0' + count;
+            }
+            fprintf(out, "%s\"%s\"", r ? ", " : "", row.c_str());
+        }
+        fprintf(out, "]}\n");
+    }
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "%ld puzzles, %ld with a unique solution, %ld "
+            "incomplete, %ld skipped, %.3f s\n", puzzles, unique,
+            incomplete, skipped, seconds);
+    return 0;
+}
+
+int run_benchmark(int iterations, const GeneratorOptions& options,
+                  FILE* out) {
+    generator_options = options;
+    if (!reset_generator()) {
+        return 1;
+    }
+    using Clock = std::chrono::steady_clock;
+    std::vector<DefaultGame> games;
+    for (int i = 0; i < 10; ++i) {
+        auto game = create_candidate_game<DefaultGame>();
+        if (!game) {
+            fprintf(stderr, "No solvable candidate found\n");
+            return 1;
+        }
+        games.push_back(*game);
+    }
+    std::vector<DefaultGame> copies(games);
+
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        DefaultGame& copy = copies[i % copies.size()];
+        copy = games[(i + 1) % games.size()];
+        asm volatile("" : : "r"(&copy) : "memory");
+    }
+    auto copy_time = Clock::now() - start;
+
+    int depth = 0;
+    start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        depth += classify_game(games[i % games.size()]).all.depth;
+    }
+    auto classify_time = Clock::now() - start;
+
+    // Speculative single deduction step, undone by copying vs. by
+    // rolling back the trail.
+    start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        DefaultGame copy = games[i % games.size()];
+        depth += copy.iterate().second;
+    }
+    auto iterate_copy_time = Clock::now() - start;
+
+    DefaultGame::Trail trail;
+    for (auto& game : games) {
+        game.set_trail(&trail);
+    }
+    start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        DefaultGame& game = games[i % games.size()];
+        auto checkpoint = game.checkpoint();
+        depth += game.iterate().second;
+        game.rollback(checkpoint);
+    }
+    auto iterate_rollback_time = Clock::now() - start;
+
+    start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        DefaultGame& game = games[i % games.size()];
+        auto checkpoint = game.checkpoint();
+        depth += classify_game_in_place(&game).all.depth;
+        game.rollback(checkpoint);
+    }
+    auto classify_rollback_time = Clock::now() - start;
+
+    using std::chrono::duration;
+    auto per_iteration = [iterations] (Clock::duration time) {
+        return duration<double, std::nano>(time).count() / iterations;
+    };
+    fprintf(out, "{ \"sizeof_game\": %zu, \"iterations\": %d, "
+            "\"copy_ns\": %.1f, \"classify_ns\": %.1f, "
+            "\"iterate_copy_ns\": %.1f, \"iterate_rollback_ns\": %.1f, "
+            "\"classify_rollback_ns\": %.1f, \"depth\": %d }\n",
+            sizeof(DefaultGame), iterations,
+            per_iteration(copy_time),
+            per_iteration(classify_time),
+            per_iteration(iterate_copy_time),
+            per_iteration(iterate_rollback_time),
+            per_iteration(classify_rollback_time),
+            depth);
+
+    return 0;
+}
+
+// Without rerunning the optimizer. Ties go to the record's own puzzle.
+int run_select_from_archive(const string& pattern,
+                            const GeneratorOptions& options, FILE* out) {
+    PuzzleReader reader(pattern);
+    PuzzleRecord record;
+    int64_t records = 0, replaced = 0;
+    while (reader.next(&record)) {
+        ++records;
+        PuzzleRecord best = record;
+        int best_score = weighted_score(record.cls, options);
+        string archive;
+        std::vector<string> members;
+        if (json_object_value(record.json, "archive", &archive)) {
+            json_array_values(archive, &members);
+        }
+        for (const auto& member : members) {
+            PuzzleRecord candidate;
+            if (!parse_puzzle_record(member, &candidate)) {
+                continue;
+            }
+            int score = weighted_score(candidate.cls, options);
+            if (score > best_score) {
+                best = candidate;
+                best_score = score;
+            }
+        }
+        if (best.json != record.json) {
+            ++replaced;
+        }
+        fprintf(out, "{ \"puzzle\": [");
+        for (int i = 0; i < best.puzzle.size(); ++i) {
+            fprintf(out, "%s%s", i ? ", " : "",
+                    json_string(best.puzzle[i]).c_str());
+        }
+        best.cls.print("], \"classification\": {", "}}\n", out);
+    }
+    fprintf(stderr, "%ld records, %ld replaced from the archive\n",
+            records, replaced);
+    return 0;
+}
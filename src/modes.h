@@ -0,0 +1,64 @@
+#ifndef LINJAT_MODES_H
+#define LINJAT_MODES_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "generator_options.h"
+
+// The modes of mklinjat other than generating puzzles, for puzzles of
+// the size the library was compiled with. Each takes its settings as
+// arguments, writes its results to out, and returns the exit status.
+
+// Solve and classify one puzzle in the format of --solve, with the
+// rules that the options leave in, and print its puzzledb record. The
+// steps go to options.solve_progress_file, if set.
+int run_solve(const std::string& map, const GeneratorOptions& options,
+              FILE* out);
+
+struct VerifyOptions {
+    // Glob pattern of the puzzledb files to classify again.
+    std::string pattern;
+    // File with the expected classifications, one per line, in place
+    // of the stored ones. Written instead with update_golden.
+    std::string golden;
+    bool update_golden = false;
+    // File with the throughput per thread of an earlier run on this
+    // machine, written if it doesn't exist yet. The run fails if the
+    // throughput is more than max_slowdown below it; 0 to not check.
+    std::string rate_file;
+    double max_slowdown = 0;
+    // 0 for one per core.
+    int threads = 0;
+};
+
+// Classify the puzzles in the files matching options.pattern again, in
+// parallel, and compare with the expected classifications. Puzzles of
+// sizes that aren't built in are skipped. Returns 1 on any difference.
+int run_verify_db(const VerifyOptions& options, FILE* out);
+
+// Solve random candidates made with the options, and then the puzzles
+// in the files matching puzzledb_pattern, with both Game and
+// ReferenceGame, and fail on the first step where they differ.
+int run_differential(int random_puzzles, const std::string& puzzledb_pattern,
+                     const GeneratorOptions& options, FILE* out);
+
+// Time the operations that the optimizer does in its inner loop, on
+// candidates made with the options.
+int run_benchmark(int iterations, const GeneratorOptions& options, FILE* out);
+
+// Count the solutions of each puzzle in the files matching pattern by
+// search, visiting at most max_nodes nodes per puzzle.
+int run_solution_space(const std::string& pattern, int64_t max_nodes,
+                       FILE* out);
+
+// Answer hint requests from in until it's closed, see --hint_server.
+int run_hint_server(FILE* in, FILE* out);
+
+// Pick the best puzzle of each record in the files matching pattern
+// and its archive for the options' --score_* weights.
+int run_select_from_archive(const std::string& pattern,
+                            const GeneratorOptions& options, FILE* out);
+
+#endif // LINJAT_MODES_H
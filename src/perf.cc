@@ -0,0 +1,146 @@
+#include "perf.h"
+
+#include <cassert>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+thread_local PerfCounters perf_counters;
+
+namespace {
+
+const char* kPhaseNames[PERF_PHASE_COUNT] = {
+    "other",
+    "candidate",
+    "dot_placement",
+    "update_possible",
+    "uncontested_no_cover",
+    "cover",
+    "single_solution",
+    "cant_fit",
+    "square",
+    "dependent",
+    "one_of",
+    "classify",
+    "optimizer",
+};
+
+struct EventSpec {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+const EventSpec kEvents[PerfCounters::EVENT_COUNT] = {
+    { "task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "l1d_read_misses", PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+
+int open_event(const EventSpec& spec, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = spec.type;
+    attr.config = spec.config;
+    attr.disabled = (group_fd == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+}
+
+PerfCounters::~PerfCounters() {
+    for (int fd : fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool PerfCounters::start() {
+    for (int event = 0; event < EVENT_COUNT; ++event) {
+        int fd = open_event(kEvents[event], leader_);
+        if (fd < 0) {
+            continue;
+        }
+        if (leader_ < 0) {
+            leader_ = fd;
+        }
+        fds_[event] = fd;
+        slot_[event] = opened_++;
+    }
+    if (leader_ < 0) {
+        fprintf(stderr, "perf_event_open failed, not collecting "
+                "performance counters\n");
+        return false;
+    }
+
+    ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    enabled_ = true;
+    stack_[0] = PERF_OTHER;
+    depth_ = 1;
+    charge();
+    return true;
+}
+
+void PerfCounters::charge() {
+    uint64_t values[1 + EVENT_COUNT];
+    if (read(leader_, values, sizeof(values)) <
+        ssize_t((1 + opened_) * sizeof(uint64_t))) {
+        return;
+    }
+    PerfPhase phase = stack_[depth_ - 1];
+    for (int event = 0; event < EVENT_COUNT; ++event) {
+        if (slot_[event] < 0) {
+            continue;
+        }
+        uint64_t value = values[1 + slot_[event]];
+        totals_[phase][event] += value - last_[event];
+        last_[event] = value;
+    }
+}
+
+void PerfCounters::enter(PerfPhase phase) {
+    assert(depth_ < sizeof(stack_) / sizeof(stack_[0]));
+    charge();
+    stack_[depth_++] = phase;
+    ++calls_[phase];
+}
+
+void PerfCounters::leave() {
+    assert(depth_ > 1);
+    charge();
+    --depth_;
+}
+
+void PerfCounters::print_json(FILE* fp) {
+    if (!enabled_) {
+        fprintf(fp, "{\"available\": false}");
+        return;
+    }
+    charge();
+    fprintf(fp, "{\"available\": true, \"phases\": {");
+    for (int phase = 0; phase < PERF_PHASE_COUNT; ++phase) {
+        fprintf(fp, "%s\"%s\": {\"calls\": %lu", phase ? ", " : "",
+                kPhaseNames[phase], calls_[phase]);
+        for (int event = 0; event < EVENT_COUNT; ++event) {
+            if (slot_[event] >= 0) {
+                fprintf(fp, ", \"%s\": %lu", kEvents[event].name,
+                        totals_[phase][event]);
+            }
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "}}");
+}
@@ -0,0 +1,97 @@
+#ifndef LINJAT_PERF_H
+#define LINJAT_PERF_H
+
+#include <cstdint>
+#include <cstdio>
+
+// The parts of generation that hardware counters are attributed to.
+// Phases nest; each counter delta is charged to the innermost active
+// phase only.
+enum PerfPhase {
+    PERF_OTHER,
+    PERF_CANDIDATE,
+    PERF_DOT_PLACEMENT,
+    PERF_UPDATE_POSSIBLE,
+    PERF_UNCONTESTED_NO_COVER,
+    PERF_COVER,
+    PERF_SINGLE_SOLUTION,
+    PERF_CANT_FIT,
+    PERF_SQUARE,
+    PERF_DEPENDENT,
+    PERF_ONE_OF,
+    PERF_CLASSIFY,
+    PERF_OPTIMIZER,
+    PERF_PHASE_COUNT,
+};
+
+// Per-phase counts of cycles, instructions, branch misses and L1D read
+// misses, from Linux perf_event_open(). Counters the kernel or
+// hardware don't support are left out; if none are available, this
+// does nothing.
+class PerfCounters {
+public:
+    enum Event {
+        TASK_CLOCK_NS,
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_READ_MISSES,
+        EVENT_COUNT,
+    };
+
+    ~PerfCounters();
+
+    // Open the counters and start counting in PERF_OTHER. Returns false
+    // if no counters could be opened.
+    bool start();
+
+    bool enabled() const {
+        return enabled_;
+    }
+
+    void enter(PerfPhase phase);
+    void leave();
+
+    void print_json(FILE* fp);
+
+private:
+    // Charge the counts since the last call to the current phase.
+    void charge();
+
+    bool enabled_ = false;
+    int leader_ = -1;
+    int fds_[EVENT_COUNT] = { -1, -1, -1, -1, -1 };
+    // Position of each event in the group read, or -1.
+    int slot_[EVENT_COUNT] = { -1, -1, -1, -1, -1 };
+    int opened_ = 0;
+
+    PerfPhase stack_[64];
+    int depth_ = 0;
+    uint64_t last_[EVENT_COUNT] = { 0 };
+    uint64_t totals_[PERF_PHASE_COUNT][EVENT_COUNT] = { { 0 } };
+    uint64_t calls_[PERF_PHASE_COUNT] = { 0 };
+};
+
+extern thread_local PerfCounters perf_counters;
+
+// Count the enclosing scope as the given phase.
+class PerfScope {
+public:
+    explicit PerfScope(PerfPhase phase)
+        : active_(perf_counters.enabled()) {
+        if (active_) {
+            perf_counters.enter(phase);
+        }
+    }
+
+    ~PerfScope() {
+        if (active_) {
+            perf_counters.leave();
+        }
+    }
+
+private:
+    bool active_;
+};
+
+#endif // LINJAT_PERF_H
@@ -0,0 +1,575 @@
+#include "puzzledb.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <glob.h>
+#include <map>
+#include <queue>
+#include <random>
+
+using std::string;
+
+namespace {
+
+const char* skip_space(const char* p) {
+    while (isspace(static_cast<unsigned char>(*p))) {
+        ++p;
+    }
+    return p;
+}
+
+// Return a pointer just past the JSON value starting at p, or null if
+// it's malformed.
+const char* skip_value(const char* p) {
+    p = skip_space(p);
+    if (*p == '"') {
+        for (++p; *p && *p != '"'; ++p) {
+            if (*p == '\\' && p[1]) {
+                ++p;
+            }
+        }
+        return *p ? p + 1 : nullptr;
+    }
+    if (*p == '{' || *p == '[') {
+        char close = (*p == '{') ? '}' : ']';
+        p = skip_space(p + 1);
+        if (*p == close) {
+            return p + 1;
+        }
+        while (true) {
+            if (close == '}') {
+                p = skip_value(p);
+                if (!p || *(p = skip_space(p)) != ':') {
+                    return nullptr;
+                }
+                ++p;
+            }
+            p = skip_value(p);
+            if (!p) {
+                return nullptr;
+            }
+            p = skip_space(p);
+            if (*p == ',') {
+                ++p;
+            } else if (*p == close) {
+                return p + 1;
+            } else {
+                return nullptr;
+            }
+        }
+    }
+    const char* start = p;
+    while (isalnum(static_cast<unsigned char>(*p)) ||
+           *p == '-' || *p == '+' || *p == '.') {
+        ++p;
+    }
+    return p == start ? nullptr : p;
+}
+
+// Decode the JSON string starting at p.
+string parse_string(const char* p, const char* end) {
+    string ret;
+    for (++p; p < end - 1; ++p) {
+        if (*p == '\\') {
+            ++p;
+        }
+        ret.push_back(*p);
+    }
+    return ret;
+}
+
+// Call fn(key, value, value_end) for each member of the JSON object or
+// each element (with an empty key) of the JSON array starting at p.
+bool for_each_member(const char* p,
+                     const std::function<void(const string&,
+                                              const char*,
+                                              const char*)>& fn) {
+    p = skip_space(p);
+    if (*p != '{' && *p != '[') {
+        return false;
+    }
+    bool object = (*p == '{');
+    char close = object ? '}' : ']';
+    p = skip_space(p + 1);
+    if (*p == close) {
+        return true;
+    }
+    while (true) {
+        string key;
+        if (object) {
+            const char* key_end = skip_value(p);
+            if (!key_end || *p != '"') {
+                return false;
+            }
+            key = parse_string(p, key_end);
+            p = skip_space(key_end);
+            if (*p != ':') {
+                return false;
+            }
+            ++p;
+        }
+        p = skip_space(p);
+        const char* value_end = skip_value(p);
+        if (!value_end) {
+            return false;
+        }
+        fn(key, p, value_end);
+        p = skip_space(value_end);
+        if (*p == ',') {
+            p = skip_space(p + 1);
+        } else {
+            return *p == close;
+        }
+    }
+}
+
+// Numbers in the collection are sometimes quoted, since Perl doesn't
+// distinguish between the two.
+int parse_int(const char* p) {
+    if (*p == '"') {
+        ++p;
+    }
+    return atoi(p);
+}
+
+}
+
+bool json_object_value(const string& object, const string& key,
+                       string* value) {
+    bool found = false;
+    for_each_member(object.c_str(),
+                    [&] (const string& k, const char* v, const char* end) {
+                        if (!found && k == key) {
+                            value->assign(v, end);
+                            found = true;
+                        }
+                    });
+    return found;
+}
+
+string json_without_member(const string& object, const string& key) {
+    // Cut from the end of the previous value, or from the start of the
+    // key if it's the first member, up to the end of its value.
+    const char* start = object.c_str();
+    const char* previous_end = nullptr;
+    const char* cut_begin = nullptr;
+    const char* cut_end = nullptr;
+    for_each_member(start,
+                    [&] (const string& k, const char* v, const char* end) {
+                        if (!cut_begin && k == key) {
+                            cut_begin = previous_end;
+                            cut_end = end;
+                        }
+                        previous_end = end;
+                    });
+    if (!cut_end) {
+        return object;
+    }
+    if (!cut_begin) {
+        // The first member: keep the '{' and drop the ',' after it.
+        cut_begin = skip_space(start) + 1;
+        const char* p = skip_space(cut_end);
+        cut_end = *p == ',' ? skip_space(p + 1) : p;
+    }
+    return object.substr(0, cut_begin - start) +
+        object.substr(cut_end - start);
+}
+
+bool json_array_values(const string& array, std::vector<string>* values) {
+    values->clear();
+    return for_each_member(array.c_str(),
+                           [&] (const string&, const char* v,
+                                const char* end) {
+                               values->emplace_back(v, end);
+                           });
+}
+
+string json_unquote(const string& value) {
+    if (value.size() < 2 || value[0] != '"') {
+        return value;
+    }
+    return parse_string(value.c_str(), value.c_str() + value.size());
+}
+
+string json_string(const string& str) {
+    string ret = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            ret.push_back('\\');
+        }
+        ret.push_back(c);
+    }
+    ret.push_back('"');
+    return ret;
+}
+
+bool read_file(const string& file, string* contents) {
+    FILE* fp = fopen(file.c_str(), "r");
+    if (!fp) {
+        perror(file.c_str());
+        return false;
+    }
+    char buf[65536];
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        contents->append(buf, count);
+    }
+    fclose(fp);
+    return true;
+}
+
+bool parse_puzzle_record(const string& line, PuzzleRecord* record) {
+    size_t end = line.find_last_not_of(" \t\r\n,");
+    if (end == string::npos) {
+        return false;
+    }
+    record->json.assign(line, 0, end + 1);
+    record->puzzle.clear();
+    record->cls = Classification();
+
+    bool have_puzzle = false;
+    bool ok = for_each_member(
+        record->json.c_str(),
+        [&] (const string& key, const char* value, const char* value_end) {
+            if (key == "puzzle") {
+                have_puzzle = for_each_member(
+                    value,
+                    [&] (const string&, const char* row, const char* row_end) {
+                        record->puzzle.push_back(parse_string(row, row_end));
+                    });
+            } else if (key == "classification") {
+                for_each_member(
+                    value,
+                    [&] (const string& name, const char* v, const char*) {
+                        SolutionMetaData* component =
+                            record->cls.component(name);
+                        if (!component) {
+                            return;
+                        }
+                        for_each_member(
+                            v,
+                            [&] (const string& metric, const char* n,
+                                 const char*) {
+                                if (metric == "depth") {
+                                    component->depth = parse_int(n);
+                                } else if (metric == "max_width") {
+                                    component->max_width = parse_int(n);
+                                }
+                            });
+                    });
+            }
+        });
+
+    return ok && have_puzzle;
+}
+
+PuzzleReader::PuzzleReader(const string& pattern) {
+    glob_t matches;
+    if (glob(pattern.c_str(), 0, nullptr, &matches) == 0) {
+        for (size_t i = 0; i < matches.gl_pathc; ++i) {
+            files_.push_back(matches.gl_pathv[i]);
+        }
+    }
+    globfree(&matches);
+}
+
+PuzzleReader::~PuzzleReader() {
+    if (fp_) {
+        fclose(fp_);
+    }
+    free(line_);
+}
+
+bool PuzzleReader::next(PuzzleRecord* record) {
+    while (file_index_ < files_.size()) {
+        if (!fp_) {
+            fp_ = fopen(files_[file_index_].c_str(), "r");
+            if (!fp_) {
+                perror(files_[file_index_].c_str());
+                ++file_index_;
+                continue;
+            }
+        }
+        while (getline(&line_, &line_size_, fp_) >= 0) {
+            if (parse_puzzle_record(line_, record)) {
+                return true;
+            }
+        }
+        fclose(fp_);
+        fp_ = nullptr;
+        ++file_index_;
+    }
+    return false;
+}
+
+void PuzzleReader::rewind() {
+    if (fp_) {
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+    file_index_ = 0;
+}
+
+namespace {
+
+struct Difficulty {
+    const char* name;
+    int height, width;
+    // Which puzzles are acceptable, see PuzzleFilter.
+    const char* accept;
+    // Added to the front of the base score formula.
+    const char* score;
+    // Replace the first five puzzles with ones from the easy end of the
+    // accepted puzzles.
+    bool add_easy_first;
+};
+
+const Difficulty kDifficulties[] = {
+    // Easy mode, must be solvable with just the rote rule.
+    { "easy", 9, 6,
+      "cover.depth>1,square.depth==0,dep.depth==0,one_of.depth==0",
+      "cant_fit.depth=1.25", true },
+    // Like easy, but a little larger levels.
+    { "medium", 10, 7,
+      "cover.depth>5,square.depth==0,dep.depth==0,one_of.depth==0",
+      "cant_fit.depth=1.1", true },
+    // Must include some dedeuction based on corners of a
+    // rectangle.
+    { "hard", 11, 8,
+      "square.depth!=0,dep.depth==0,one_of.depth==0",
+      "", false },
+    // Everything.
+    { "expert", 13, 9, "", "const=1", false },
+};
+
+struct TutorialStep {
+    std::vector<string> puzzle;
+    const char* message;
+};
+
+// Hand-built examples with explanatory text
+const TutorialStep kTutorial[] = {
+    { { "    ",
+        "    ",
+        ".  4",
+        "    " },
+      "Drag the 4 over the dot. Then click 'Done' to check the solution." },
+    { { "    ",
+        "    ",
+        ".3. ",
+        "    " },
+      "Lines can extend in both directions. Cover both of the dots by drawing a line from the 3 to the left, and then again to the right. Then click 'Done'." },
+    { { " 4  ",
+        "    ",
+        ". 3 ",
+        "    " },
+      "Drag the 3 over the dot. That means the 4 will only fit in horizontally. Draw that line too, and click 'Done'." },
+    { { },
+      "You should be good to go now! But take care: the actual puzzles might require types of logical deduction that weren't part of this tutorial." },
+};
+
+string step_json(const std::vector<string>& puzzle, const string& message) {
+    string ret = "{\"puzzle\":";
+    if (puzzle.empty()) {
+        ret += "null";
+    } else {
+        ret += "[";
+        for (int i = 0; i < puzzle.size(); ++i) {
+            ret += (i ? "," : "") + json_string(puzzle[i]);
+        }
+        ret += "]";
+    }
+    return ret + ",\"message\":" + json_string(message) + "}";
+}
+
+string tutorial_json() {
+    string ret = "[";
+    for (int i = 0; i < sizeof(kTutorial) / sizeof(kTutorial[0]); ++i) {
+        ret += (i ? "," : "") + step_json(kTutorial[i].puzzle,
+                                          kTutorial[i].message);
+    }
+    return ret + "]";
+}
+
+struct RankedPuzzle {
+    double score;
+    // Position in the input, to break ties the same way a stable sort
+    // would.
+    int64_t seq;
+    string file;
+    string json;
+    Classification cls;
+
+    bool operator<(const RankedPuzzle& other) const {
+        return score > other.score ||
+            (score == other.score && seq < other.seq);
+    }
+};
+
+// The puzzle as it goes into puzzles.json. Any --pareto_archive of the
+// record is only for --select_from_archive, not for the site.
+string ranked_json(const RankedPuzzle& puzzle) {
+    char score[32];
+    snprintf(score, sizeof(score), "%.15g", puzzle.score);
+    return "{\"file\":" + json_string(puzzle.file) +
+        ",\"score\":" + score + "," +
+        json_without_member(puzzle.json, "archive").substr(1);
+}
+
+string difficulty_json(const Difficulty& difficulty,
+                       const CollectionOptions& options,
+                       std::mt19937* rng) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "/h=%d_w=%d_*",
+             difficulty.height, difficulty.width);
+    PuzzleReader reader(options.puzzledb_dir + pattern);
+    // The difficulties are built in, and build_collection() checked
+    // options.score.
+    PuzzleFilter accept;
+    PuzzleFilter::parse(difficulty.accept, &accept);
+    string formula_spec = difficulty.score;
+    if (!formula_spec.empty() && !options.score.empty()) {
+        formula_spec += ",";
+    }
+    ScoreFormula formula;
+    ScoreFormula::parse(formula_spec + options.score, &formula);
+
+    // The best options.size puzzles, with the worst one on top. Also
+    // count the puzzles per score, to find the easy ones later.
+    std::priority_queue<RankedPuzzle> best;
+    std::map<double, int64_t, std::greater<double>> score_counts;
+    int64_t accepted = 0;
+    int64_t seq = 0;
+    PuzzleRecord record;
+    while (reader.next(&record)) {
+        ++seq;
+        if (!accept.accepts(record.cls, 0)) {
+            continue;
+        }
+        double score = formula.score(record.cls);
+        ++accepted;
+        ++score_counts[score];
+        if (best.size() < options.size || score > best.top().score) {
+            best.push(RankedPuzzle { score, seq, reader.file(),
+                                     record.json, record.cls });
+            if (best.size() > options.size) {
+                best.pop();
+            }
+        }
+    }
+
+    std::vector<RankedPuzzle> output;
+    while (!best.empty()) {
+        output.push_back(best.top());
+        best.pop();
+    }
+    std::reverse(output.begin(), output.end());
+    for (const auto& puzzle : output) {
+        const Classification& cls = puzzle.cls;
+        fprintf(stderr, "%.15g %d | %d %d %d %d %d %s\n",
+                puzzle.score, cls.all.max_width,
+                cls.cover.depth, cls.cant_fit.depth, cls.square.depth,
+                cls.one_of.depth, cls.dep.depth, puzzle.file.c_str());
+    }
+
+    std::vector<string> shuffled;
+    for (const auto& puzzle : output) {
+        shuffled.push_back(ranked_json(puzzle));
+    }
+    std::shuffle(shuffled.begin(), shuffled.end(), *rng);
+
+    if (difficulty.add_easy_first && accepted) {
+        // Take puzzles from 100%, 90%, ..., 60% of the way down the
+        // sorted list of all accepted puzzles. That needs a second
+        // pass, looking for the n'th puzzle of a given score.
+        int64_t last = accepted - 1;
+        std::map<std::pair<double, int64_t>, std::vector<int>> wanted;
+        for (int i = 0; i < 5; ++i) {
+            int64_t rank = last * (1 - i / 10.0);
+            for (const auto& count : score_counts) {
+                if (rank < count.second) {
+                    wanted[{ count.first, rank }].push_back(i);
+                    break;
+                }
+                rank -= count.second;
+            }
+        }
+        std::map<double, int64_t> seen;
+        reader.rewind();
+        while (!wanted.empty() && reader.next(&record)) {
+            if (!accept.accepts(record.cls, 0)) {
+                continue;
+            }
+            double score = formula.score(record.cls);
+            auto it = wanted.find({ score, seen[score]++ });
+            if (it == wanted.end()) {
+                continue;
+            }
+            RankedPuzzle puzzle { score, 0, reader.file(), record.json,
+                                  record.cls };
+            for (int i : it->second) {
+                if (i >= shuffled.size()) {
+                    shuffled.resize(i + 1, "null");
+                }
+                shuffled[i] = ranked_json(puzzle);
+            }
+            wanted.erase(it);
+        }
+    }
+
+    string ret = "[";
+    for (const auto& puzzle : shuffled) {
+        ret += puzzle + ",";
+    }
+    return ret + step_json({}, "Congratulations, you've solved all "
+                           "available puzzles for this difficulty level.") +
+        "]";
+}
+
+}
+
+int build_collection(const CollectionOptions& options, FILE* out) {
+    ScoreFormula formula;
+    if (!ScoreFormula::parse(options.score, &formula)) {
+        return 1;
+    }
+    std::map<string, string> overrides;
+    for (const auto& merge : options.merge) {
+        string contents, value;
+        if (!read_file(merge.second, &contents)) {
+            return 1;
+        }
+        if (!json_object_value(contents, merge.first, &value)) {
+            value = "null";
+        }
+        overrides[merge.first] = value;
+    }
+
+    std::mt19937 rng(options.seed);
+    auto emit = [&] (const string& key, const std::function<string()>& fn) {
+        fprintf(out, "%s%s:", key == "tutorial" ? "{" : ",",
+                json_string(key).c_str());
+        auto it = overrides.find(key);
+        fputs(it == overrides.end() ? fn().c_str() : it->second.c_str(), out);
+        if (it != overrides.end()) {
+            overrides.erase(it);
+        }
+    };
+
+    emit("tutorial", tutorial_json);
+    for (const auto& difficulty : kDifficulties) {
+        emit(difficulty.name, [&] () {
+                return difficulty_json(difficulty, options, &rng);
+            });
+    }
+    for (const auto& extra : overrides) {
+        fprintf(out, ",%s:%s", json_string(extra.first).c_str(),
+                extra.second.c_str());
+    }
+    fprintf(out, "}\n");
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef LINJAT_PUZZLEDB_H
+#define LINJAT_PUZZLEDB_H
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "classification.h"
+
+// One puzzle as stored in the puzzledb files, which have one JSON
+// object per line.
+struct PuzzleRecord {
+    // The JSON object, without any trailing comma or whitespace.
+    std::string json;
+    std::vector<std::string> puzzle;
+    Classification cls;
+};
+
+// Parse one puzzledb line. Returns false for blank or malformed lines.
+bool parse_puzzle_record(const std::string& line, PuzzleRecord* record);
+
+// Find the value of a top-level key in a JSON object, and return its
+// JSON text.
+bool json_object_value(const std::string& object, const std::string& key,
+                       std::string* value);
+
+// The JSON object without the top-level key, if it has it. The rest of
+// the text is kept as is.
+std::string json_without_member(const std::string& object,
+                                const std::string& key);
+
+// Split a JSON array into the JSON text of its elements.
+bool json_array_values(const std::string& array,
+                       std::vector<std::string>* values);
+
+// Quote and escape a string for JSON output.
+std::string json_string(const std::string& str);
+
+// The inverse of json_string(). Values that aren't strings are returned
+// as is.
+std::string json_unquote(const std::string& value);
+
+bool read_file(const std::string& file, std::string* contents);
+
+// Streams the records of all files matching a glob pattern, in file
+// name order, without loading whole files into memory.
+class PuzzleReader {
+public:
+    explicit PuzzleReader(const std::string& pattern);
+    ~PuzzleReader();
+
+    bool next(PuzzleRecord* record);
+
+    // Start over from the first record of the first file.
+    void rewind();
+
+    // The file of the record last returned by next().
+    const std::string& file() const {
+        return files_[file_index_];
+    }
+
+    const std::vector<std::string>& files() const {
+        return files_;
+    }
+
+private:
+    std::vector<std::string> files_;
+    size_t file_index_ = 0;
+    FILE* fp_ = nullptr;
+    char* line_ = nullptr;
+    size_t line_size_ = 0;
+};
+
+struct CollectionOptions {
+    std::string puzzledb_dir = "puzzledb";
+    // Puzzles to keep per difficulty.
+    int size = 99;
+    unsigned seed = 1;
+    // The base score formula, see ScoreFormula.
+    std::string score;
+    // Replace the value of a key of the collection with the value of
+    // the same key in a JSON file.
+    std::vector<std::pair<std::string, std::string>> merge;
+};
+
+// Build the puzzle collection served to the web client from the
+// puzzledb files, and write it to out as JSON. Does the same as
+// build-puzzle-collection.pl, but streams the puzzledb, keeping only
+// the best options.size records per difficulty in memory.
+int build_collection(const CollectionOptions& options, FILE* out);
+
+#endif // LINJAT_PUZZLEDB_H
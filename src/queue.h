@@ -0,0 +1,74 @@
+#ifndef LINJAT_QUEUE_H
+#define LINJAT_QUEUE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// A bounded FIFO between the stages of a pipeline, for any number of
+// producers and consumers. push() waits while the queue is full and
+// pop() while it's empty. After close(), pop() drains what's left and
+// then returns false.
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(int capacity) : capacity_(capacity) {
+    }
+
+    void push(T item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [&] {
+                    return items_.size() < capacity_;
+                });
+            items_.push_back(std::move(item));
+        }
+        not_empty_.notify_one();
+    }
+
+    bool pop(T* item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [&] {
+                    return closed_ || !items_.empty();
+                });
+            if (items_.empty()) {
+                return false;
+            }
+            queued_sum_ += items_.size();
+            ++pops_;
+            *item = std::move(items_.front());
+            items_.pop_front();
+        }
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+    }
+
+    // The mean number of items that were waiting when one was popped.
+    double mean_queued() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pops_ ? double(queued_sum_) / pops_ : 0.0;
+    }
+
+private:
+    const int capacity_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    int64_t queued_sum_ = 0;
+    int64_t pops_ = 0;
+};
+
+#endif // LINJAT_QUEUE_H
@@ -0,0 +1,835 @@
+#ifndef LINJAT_REFERENCE_GAME_H
+#define LINJAT_REFERENCE_GAME_H
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+#include "game.h"
+
+// The solver as it was before Game was optimized: 64-bit masks
+// everywhere, no undo trail, no incremental updates, one rule at a time
+// in the most direct way. It only solves, so it has no candidate
+// generation or mutation. --differential runs it in lockstep with Game
+// to check that optimizations to Game don't change any deduction.
+// Keep it slow and obvious; don't optimize it.
+template <int MapHeight, int MapWidth, int Pieces>
+class ReferenceGame {
+public:
+    static const int W = MapWidth + 1, H = MapHeight, N = Pieces;
+
+    using Hint = std::pair<uint16_t, uint16_t>;
+    using Mask = uint64_t;
+    using MaskArray = std::array<Mask, H * W>;
+    using DepMask = std::bitset<H * W>;
+
+    using IterationResult = std::pair<DeductionKind, int>;
+
+    explicit ReferenceGame(const std::string& puzzle) {
+        for (int r = 0; r < H; ++r) {
+            border_[r * W] = 1;
+        }
+        setup_map(puzzle);
+        reset_hints();
+        reset_possible();
+        update_possible();
+    }
+
+    void setup_map(const std::string& map) {
+        assert(map.size() == W * H);
+
+        int pieces = 0;
+        for (int i = 0; i < H * W; ++i) {
+            if (map[i] == ',') {
+                assert(border_[i]);
+            } else if (map[i] == '.') {
+                forced_[i] = true;
+            } else if (isdigit(map[i])) {
+                int val = map[i] - '0';
+                hints_[pieces] = Hint(i, val);
+                fixed_[i] = piece_mask(pieces++);
+            }
+        }
+
+        assert(pieces == N);
+    }
+
+    void reset_hints() {
+        for (int at = 0; at < W * H; ++at) {
+            fixed_[at] = 0;
+        }
+        for (int i = 0; i < N; ++i) {
+            auto& hint = hints_[i];
+            fixed_[hint.first] = piece_mask(i);
+        }
+        for (int i = 0; i < N; ++i) {
+            valid_orientation_[i] = init_valid_orientations(i);
+        }
+    }
+
+    void reset_possible() {
+        for (int at = 0; at < W * H; ++at) {
+            possible_[at] = 0;
+        }
+    }
+
+    // See Game.
+    int fixed_piece(int at) const {
+        return fixed_[at] ? __builtin_ctzl(fixed_[at]) : -1;
+    }
+
+    uint16_t valid_orientations(int piece) const {
+        return valid_orientation_[piece];
+    }
+
+    IterationResult iterate() {
+        reset_possible();
+
+        {
+            update_possible();
+            int count;
+
+            count = update_uncontested_no_cover();
+            if (count) {
+                return { DeductionKind::UNCONTESTED_NO_COVER, count };
+            }
+
+            count = update_forced_coverage();
+            if (count) {
+                return { DeductionKind::COVER, count };
+            }
+
+            // Put this after forced_coverage, since it's not interesting
+            // if abusing knowledge of a single solution gives just the
+            // same deduction as the trivial rule.
+            count = update_knowledge_of_single_solution();
+            if (count) {
+                update_forced_coverage();
+                return { DeductionKind::SINGLE_SOLUTION, count };
+            }
+
+            count = update_cant_fit();
+            if (count) {
+                return { DeductionKind::CANT_FIT, count };
+            }
+        }
+
+
+        {
+            update_square();
+            // Is there really no need to check u_forced_coverage
+            // here?
+            int count = update_cant_fit();
+            if (count) {
+                return { DeductionKind::SQUARE, count };
+            }
+        }
+
+        {
+            update_dependent();
+            int count = update_cant_fit();
+            if (count) {
+                return { DeductionKind::DEPENDENCY, count };
+            }
+        }
+
+        {
+            update_one_of();
+            int count = update_cant_fit();
+            if (count) {
+                return { DeductionKind::ONE_OF, count };
+            }
+        }
+
+        return { DeductionKind::NONE, 0 };
+    }
+
+    int update_cant_fit() {
+        int count = 0;
+        for (int piece = 0; piece < N; ++piece) {
+            count += update_cant_fit_for_piece(piece);
+        }
+        return count;
+    }
+
+    int update_forced_coverage() {
+        int count = 0;
+        for (int piece = 0; piece < N; ++piece) {
+            count += update_forced_coverage_for_piece(piece);
+        }
+        return count;
+    }
+
+private:
+    int possible_count(int at) {
+        return __builtin_popcountl(possible_[at]);
+    }
+
+    Mask piece_mask(uint64_t piece) {
+        return UINT64_C(1) << piece;
+    }
+
+    int mask_to_piece(Mask mask) {
+        return __builtin_ctzl(mask);
+    }
+
+    int orientation_count(int piece) {
+        return __builtin_popcountl(valid_orientation_[piece]);
+    }
+
+    void update_possible() {
+        for (int piece = 0; piece < N; ++piece) {
+            update_possible_for_piece(piece);
+        }
+    }
+
+    void update_possible_for_piece(int piece) {
+        Mask mask = piece_mask(piece);
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                int count = 0;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (!fixed_[at] || fixed_[at] == mask) {
+                        ++count;
+                    }
+                }
+                if (count == size) {
+                    for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                        possible_[at] |= mask;
+                    }
+                } else {
+                    valid_orientation_[piece] &= ~(1 << o);
+                }
+            }
+        }
+    }
+
+    int update_forced_coverage_for_piece(int piece) {
+        Mask mask = piece_mask(piece);
+        int updated = 0;
+
+        for (int at : PieceIterator(hints_[piece])) {
+            if (!fixed_[at]) {
+                if ((forced_[at] && possible_[at] == mask)) {
+                    updated = 1;
+                    fixed_[at] = mask;
+                    update_not_possible(at, mask, piece);
+                }
+            }
+        }
+
+        return updated;
+    }
+
+    int update_cant_fit_for_piece(int piece) {
+        Mask mask = piece_mask(piece);
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        int valid_count = 0;
+        std::array<uint8_t, W*H> count = { 0 };
+
+        if (!valid_o) {
+            return 0;
+        }
+
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                bool ok = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (!(possible_[at] & mask)) {
+                        ok = false;
+                    }
+                }
+                if (ok) {
+                    ++valid_count;
+                    for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                        count[at]++;
+                    }
+                }
+            }
+        }
+
+        int updated = 0;
+        for (int at : PieceIterator(hints_[piece])) {
+            if (!fixed_[at]) {
+                if (count[at] == valid_count) {
+                    updated = 1;
+                    fixed_[at] = mask;
+                    update_not_possible(at, mask, piece);
+                }
+            }
+        }
+
+        return updated;
+    }
+
+    void update_not_possible(int update_at, Mask mask, int piece) {
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                bool no_intersect = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (at == update_at) {
+                        no_intersect = false;
+                    }
+                }
+                if (no_intersect) {
+                    valid_orientation_[piece] &= ~(1 << o);
+                }
+            }
+        }
+    }
+
+    int init_valid_orientations(int piece) {
+        int size = hints_[piece].second;
+        int ret = 0;
+        for (int o = 0; o < size * 2; ++o) {
+            int count = 0;
+            for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                if (!border_[at] &&
+                    (!fixed_[at] || fixed_[at] == piece_mask(piece))) {
+                    ++count;
+                }
+            }
+            bool fit2 = (count == size);
+            if (fit2) {
+                ret |= (1 << o);
+            }
+        }
+        return ret;
+    }
+
+    class PieceOrientationIterator {
+    public:
+        PieceOrientationIterator(Hint piece, int orientation) {
+            int at = piece.first;
+            int size = piece.second;
+            int offset = (size - 1) - (orientation >> 1);
+
+            step_ = ((orientation & 1) ? W : 1);
+            start_ = at - offset * step_;
+            end_ = start_ + size * step_;
+
+            if (start_ < 0 || end_ >= W * H + step_) {
+                start_ = end_ = -1;
+            }
+        }
+
+        struct iterator {
+            iterator(int i, int step) : i_(i), step_(step) {
+            }
+
+            bool operator!=(const iterator& other) const {
+                return i_ != other.i_;
+            }
+
+            int operator*() {
+                return i_;
+            }
+
+            int operator++() {
+                i_ += step_;
+                return i_;
+            }
+
+            int i_, step_;
+        };
+
+        iterator begin() {
+            return iterator(start_, step_);
+        }
+
+        iterator end() {
+            return iterator(end_, step_);
+        }
+
+    private:
+        int start_, end_, step_;
+    };
+
+    class PieceIterator {
+    public:
+        using Indices = std::array<int, 1 + 2*9 + 2*9>;
+
+        PieceIterator(Hint piece) {
+            int at = piece.first;
+            int size = piece.second;
+            is_[size_++] = at;
+
+            int r = at / W;
+            int c = at % W;
+            // The column.
+            for (int ri = std::max(0, r - (size - 1));
+                 ri < std::min(H, r + size);
+                 ++ri) {
+                int at2 = ri * W + c;
+                if (at2 != at)
+                    is_[size_++] = at2;
+            }
+            // The row.
+            for (int ci = std::max(0, c - (size - 1));
+                 ci < std::min(W, c + size);
+                 ++ci) {
+                int at2 = ci + r * W;
+                if (at2 != at)
+                    is_[size_++] = at2;
+            }
+        }
+
+        struct iterator {
+            iterator(int i, Indices* is) : i_(i), is_(is) {
+            }
+
+            bool operator!=(const iterator& other) const {
+                return i_ != other.i_ || is_ != other.is_;
+            }
+
+            int operator*() {
+                return (*is_)[i_];
+            }
+
+            void operator++() {
+                i_++;
+            }
+
+            int i_;
+            Indices* is_;
+        };
+
+        iterator begin() {
+            return iterator(0, &is_);
+        }
+
+        iterator end() {
+            return iterator(size_, &is_);
+        }
+
+    private:
+        int size_ = 0;
+        Indices is_;
+    };
+
+    int update_uncontested_no_cover() {
+        int count = 0;
+        for (int piece = 0; piece < N; ++piece) {
+            int omask = find_uncontested_no_cover(piece);
+            if (!omask)
+                continue;
+            // Found a viable uncontested orientation for the piece.
+            valid_orientation_[piece] = omask;
+            {
+                int o = __builtin_ctzl(omask);
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (!fixed_[at]) {
+                        fixed_[at] = piece_mask(piece);
+                        update_not_possible(at,
+                                            piece_mask(piece),
+                                            piece);
+                    }
+                }
+            }
+            return 1;
+        }
+        return count;
+    }
+
+    int find_uncontested_no_cover(int piece) {
+        // If a piece can't be used to cover any more dots, see if there
+        // are any totally uncontested orientations. If there is one,
+        // just choose it as the actual orientation.
+
+        Mask mask = piece_mask(piece);
+        bool have_contested = false;
+
+        // Bail out early if the piece can still be used to cover a
+        // dot.
+        for (int at : PieceIterator(hints_[piece])) {
+            if (!fixed_[at] && forced_[at] &&
+                (possible_[at] & mask)) {
+                return 0;
+            }
+            if ((possible_[at] & mask) && possible_[at] != mask) {
+                have_contested = true;
+            }
+        }
+
+        // If none of the orientations are contested, this is an
+        // uninteresting case.
+        if (!have_contested) {
+            return 0;
+        }
+
+        // Iterate through all orientations of the piece. Look how many
+        // match orientation A from the intro, how many B/C.
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                // In this orientation either all squares are already
+                // covered by this piece, or can only be covered by
+                // this piece.
+                bool ok = true;
+                bool non_fixed = false;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (fixed_[at]) {
+                        if (fixed_[at] != mask)
+                            ok = false;
+                    } else {
+                        non_fixed = true;
+                        if (possible_[at] != mask)
+                            ok = false;
+                    }
+                }
+                if (ok && non_fixed) {
+                    return 1 << o;
+                }
+            }
+        }
+
+        return 0;
+    }
+
+    int update_knowledge_of_single_solution() {
+        int count = 0;
+        for (int piece = 0; piece < N; ++piece) {
+            count += find_knowledge_of_single_solution(piece);
+        }
+        return count;
+    }
+
+    int find_knowledge_of_single_solution(int piece) {
+        // Given a piece P, split the valid orientations into two
+        // groups.  Those where P overlaps with either a dot or a
+        // valid orientation of some other piece (have information),
+        // and those where it doesn't (no information).
+        //
+        // If there are multiple "no information" orientations, a
+        // level generator using a single solution can't possibly
+        // distinguish between them. Any squares covered by all of the
+        // "have information" orientations must therefore be part
+        // of the solution.
+
+        DepMask have_information_union;
+        int have_information_count = 0;
+        int no_information_count = 0;
+
+        // Iterate through all orientations of the piece. Look how many
+        // match orientation A from the intro, how many B/C.
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                DepMask covered;
+                bool ok = true;
+                bool overlaps_forced = false;
+                bool cant_overlap_with_other_pieces = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    covered.set(at);
+                    if (!fixed_[at]) {
+                        if (forced_[at])
+                            overlaps_forced = true;
+                        if (possible_count(at) != 1)
+                            cant_overlap_with_other_pieces = false;
+                    } else if (fixed_[at] != piece_mask(piece)) {
+                        ok = false;
+                    }
+                }
+                if (!ok) {
+                    continue;
+                }
+                if (overlaps_forced) {
+                    if (have_information_count++) {
+                        have_information_union &= covered;
+                    } else {
+                        have_information_union = covered;
+                    }
+                } else if (!overlaps_forced &&
+                           cant_overlap_with_other_pieces) {
+                    no_information_count++;
+                }
+            }
+        }
+
+        if (no_information_count > 1) {
+            int update_count = 0;
+            for (int at : PieceIterator(hints_[piece])) {
+                if (fixed_[at])
+                    continue;
+                if (have_information_union[at]) {
+                    fixed_[at] = piece_mask(piece);
+                    update_not_possible(at, piece_mask(piece), piece);
+                    ++update_count;
+                }
+             }
+            return update_count;
+        }
+        return 0;
+    }
+
+    // Find dependencies. E.g.:
+    //
+    //   53.. 4
+    //    5 2
+    //
+    // Above any row that covers the left dot must also cover the right
+    // dot. So the 2 can't go up to cover the right dot.
+    void update_dependent() {
+        for (int at = 0; at < W * H; ++at) {
+            if (!forced_[at])
+                continue;
+            if (fixed_[at])
+                continue;
+            if (possible_count(at) <= 1)
+                continue;
+            DepMask dep;
+            dep.set();
+            for (int piece = 0; piece < N; ++piece) {
+                if (!(piece_mask(piece) & possible_[at]))
+                    continue;
+                dep &= find_dependent(piece, at);
+            }
+            if (dep.count() > 1) {
+                for (int target = 0; target < N; ++target) {
+                    if (dep[target] &&
+                        target != at &&
+                        possible_[at] != possible_[target]) {
+                        if (forced_[target]) {
+                            possible_[target] = possible_[at] =
+                                (possible_[target] & possible_[at]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    DepMask find_one_of(int piece, int target) {
+        return find_dependent(piece, target, false);
+    }
+
+    DepMask find_dependent(int piece, int target,
+                           bool wanted_overlap = true) {
+        Mask mask = piece_mask(piece);
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+        DepMask ret;
+        ret.set();
+
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                bool overlaps_target = false;
+                bool ok = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (at == target)
+                        overlaps_target = true;
+                    if (fixed_[at] && fixed_[at] != mask)
+                        ok = false;
+                }
+                if (overlaps_target == wanted_overlap && ok) {
+                    DepMask mask;
+                    for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                        mask[at] = true;
+                    }
+                    ret &= mask;
+                }
+            }
+        }
+
+        // With no matching orientation, every square counts as
+        // dependent. This used to be reset to none by a flag that was
+        // never initialized, which in practice left it set, and the
+        // puzzledb classifications depend on that.
+        return ret;
+    }
+
+    //      Y   5
+    //    X 4   Z
+    //
+    // 4 needs to cover either Y or Z, so can't cover X.
+    void update_square() {
+        for (int piece = 0; piece < N; ++piece) {
+            int size = hints_[piece].second;
+            std::vector<int> covered;
+            for (int at : PieceIterator(hints_[piece])) {
+                if (!forced_[at] || fixed_[at] ||
+                    possible_count(at) != 2)
+                    continue;
+                if (!(possible_[at] & piece_mask(piece)))
+                    continue;
+                covered.push_back(at);
+            }
+            // Find pairs of squares where:
+            // - Both can be covered by the candidate and one other
+            //   piece (the same in both cases).
+            // - The candidate piece can't cover both squares at the same
+            //   time. (That will implicitly mean that the other piece
+            //   can't do it either).
+            for (int i = 0; i < covered.size(); ++i) {
+                for (int j = i + 1; j < covered.size(); ++j) {
+                    int ai = covered[i], aj = covered[j];
+                    if (distance(ai, aj) <= size)
+                        continue;
+                    Mask pi = possible_[ai], pj = possible_[aj];
+                    if (pi != pj)
+                        continue;
+                    // Remove any orientations of the piece that
+                    // don't cover at least one of the two squares.
+                    int valid_o = valid_orientation_[piece];
+                    for (int o = 0; o < size * 2; ++o) {
+                        if (valid_o & (1 << o)) {
+                            bool no_candidate = true;
+                            for (int at :
+                                 PieceOrientationIterator(hints_[piece], o)) {
+                                if (at == ai || at == aj)
+                                    no_candidate = false;
+                            }
+                            if (no_candidate) {
+                                valid_orientation_[piece] &= ~(1 << o);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Find dependencies. E.g.:
+    //
+    //----
+    //  y2
+    //  3.
+    //  Y2
+    // ---
+    //
+    // Both 2s can't be vertical, so either Y or y must be
+    // filled. So 3 must be horizontal.
+    void update_one_of() {
+        for (int at = 0; at < W * H; ++at) {
+            // Find squares where two pieces on the same
+            // row / column can intersect.
+            if (fixed_[at])
+                continue;
+            if (possible_count(at) < 2)
+                continue;
+            int piece_a = 0, piece_b = 0;
+            // This is slightly suboptimal that it'll only
+            // find one pair of potential a / b piece, not
+            // pairs.
+            if (!find_pieces_on_same_row_or_column(at,
+                                                   &piece_a,
+                                                   &piece_b))
+                continue;
+            // For each of those two pieces, find the set of squares
+            // that they must pass through if they don't go through
+            // the intersecting square.
+            DepMask a = find_one_of(piece_a, at);
+            DepMask b = find_one_of(piece_b, at);
+            Mask target_pieces_a = 0;
+            Mask target_pieces_b = 0;
+            // Then see if there exists a piece that could
+            // intersect with both of the above sets.
+            for (int target = 0; target < W * H; ++target) {
+                if (!a[target] && !b[target])
+                    continue;
+                for (int piece = 0; piece < N; ++piece) {
+                    if (piece == piece_a || piece == piece_b)
+                        continue;
+                    if (piece_mask(piece) & possible_[target]) {
+                        if (a[target])
+                            target_pieces_a |= piece_mask(piece);
+                        if (b[target])
+                            target_pieces_b |= piece_mask(piece);
+                    }
+                }
+            }
+            Mask target_pieces_both = target_pieces_a &
+                target_pieces_b;
+            if (target_pieces_both) {
+                // If such a piece exists, check if the piece
+                // can intersect with both sets at the same time.
+                // If it can, exclude any such orientations.
+                for (int piece = 0; piece < N; ++piece) {
+                    if (piece_mask(piece) & target_pieces_both) {
+                        exclude_if_in_both_sets(piece, a, b);
+                    }
+                }
+            }
+        }
+    }
+
+    bool find_pieces_on_same_row_or_column(int at, int* a, int* b) {
+        int possible = possible_[at];
+        for (int i = 0; i < N; ++i) {
+            if (!(possible & piece_mask(i)))
+                continue;
+            for (int j = i + 1; j < N; ++j) {
+                if (!(possible & piece_mask(j)))
+                    continue;
+                int a_at = hints_[i].first;
+                int b_at = hints_[j].first;
+                if ((a_at / W == b_at / W) ||
+                    (a_at % W == b_at % W)) {
+                    *a = i;
+                    *b = j;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    void exclude_if_in_both_sets(int piece,
+                                 const DepMask& a,
+                                 const DepMask& b) {
+        Mask mask = piece_mask(piece);
+        int size = hints_[piece].second;
+        int valid_o = valid_orientation_[piece];
+
+        for (int o = 0; o < size * 2; ++o) {
+            if (valid_o & (1 << o)) {
+                bool a_hit = false, b_hit = false;
+                bool ok = true;
+                for (int at : PieceOrientationIterator(hints_[piece], o)) {
+                    if (a[at]) a_hit = true;
+                    if (b[at]) b_hit = true;
+                    if (fixed_[at] && fixed_[at] != mask) {
+                        ok = false;
+                    }
+                }
+                if (ok && a_hit && b_hit) {
+                    valid_orientation_[piece] &= ~(1 << o);
+                }
+            }
+        }
+    }
+
+    int distance(int a, int b) {
+        int ra = a / W, rb = b / W,
+            ca = a % W, cb = b % W;
+        int rd = std::abs(ra - rb), cd = std::abs(ca - cb);
+        if (rd && cd) {
+            return W + H + 1;
+        }
+        return rd + cd;
+    }
+
+    std::array<Hint, N> hints_;
+    uint16_t valid_orientation_[N] { 0 };
+    MaskArray possible_ = { 0 };
+    MaskArray fixed_ = { 0 };
+    bool forced_[H * W] = { 0 };
+    bool border_[H * W] = { 0 };
+};
+
+#endif // LINJAT_REFERENCE_GAME_H
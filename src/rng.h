@@ -0,0 +1,90 @@
+#ifndef LINJAT_RNG_H
+#define LINJAT_RNG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Produces the same sequence as srandom() / random() (and so srand()
+// / rand()) with glibc, but the state can be saved to and restored
+// from a string for checkpointing.
+class Rng {
+public:
+    explicit Rng(unsigned seed = 1) {
+        reseed(seed);
+    }
+
+    // random_data points into state_, so copies would share state.
+    Rng(const Rng&) = delete;
+    Rng& operator=(const Rng&) = delete;
+
+    void reseed(unsigned seed) {
+        memset(&data_, 0, sizeof(data_));
+        initstate_r(seed, state_, sizeof(state_), &data_);
+    }
+
+    int32_t operator()() {
+        int32_t ret;
+        random_r(&data_, &ret);
+        return ret;
+    }
+
+    std::string save() const {
+        std::string ret;
+        char buf[16];
+        for (unsigned char c : state_) {
+            snprintf(buf, sizeof(buf), "%02x", c);
+            ret += buf;
+        }
+        snprintf(buf, sizeof(buf), ":%d:%d",
+                 int(data_.fptr - data_.state),
+                 int(data_.rptr - data_.state));
+        return ret + buf;
+    }
+
+    bool restore(const std::string& saved) {
+        char state[sizeof(state_)];
+        int fptr, rptr;
+        if (saved.size() < 2 * sizeof(state_) ||
+            sscanf(saved.c_str() + 2 * sizeof(state_), ":%d:%d",
+                   &fptr, &rptr) != 2) {
+            return false;
+        }
+        for (int i = 0; i < sizeof(state_); ++i) {
+            state[i] = strtol(saved.substr(2 * i, 2).c_str(), nullptr, 16);
+        }
+        reseed(1);
+        if (fptr < 0 || rptr < 0 ||
+            fptr >= data_.end_ptr - data_.state ||
+            rptr >= data_.end_ptr - data_.state) {
+            return false;
+        }
+        memcpy(state_, state, sizeof(state_));
+        data_.fptr = data_.state + fptr;
+        data_.rptr = data_.state + rptr;
+        return true;
+    }
+
+private:
+    char state_[128];
+    random_data data_;
+};
+
+// The seed for puzzle number index of a run with the given seed, for
+// --shard, so that each puzzle can be generated on its own. Nearby
+// seeds and indices give unrelated seeds (this is SplitMix64).
+inline unsigned puzzle_seed(unsigned seed, int64_t index) {
+    uint64_t z = (uint64_t(seed) << 32) + uint64_t(index) +
+        0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return unsigned(z ^ (z >> 31));
+}
+
+// All randomness comes from here, so that the state can be
+// checkpointed. Each thread has its own.
+extern thread_local Rng rng;
+
+#endif // LINJAT_RNG_H
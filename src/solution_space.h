@@ -0,0 +1,262 @@
+#ifndef LINJAT_SOLUTION_SPACE_H
+#define LINJAT_SOLUTION_SPACE_H
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "game.h"
+
+// Every solution of a puzzle, found by search rather than by the
+// deduction rules: a placement of each piece in one of its
+// orientations, with no two pieces overlapping and every dot covered.
+//
+// The search splits the pieces into groups that can't interact, since
+// no square can be covered by pieces from two groups, and solves each
+// group on its own. The number of solutions is the product over the
+// groups. The groups are found again with a union-find after each
+// placement, since placing a piece often cuts the rest of its group
+// in two. This keeps the full analysis affordable on the largest
+// boards, where a monolithic search would multiply out every
+// independent choice.
+template <class G>
+class SolutionSpace {
+public:
+    using SquareSet = typename G::SquareSet;
+
+    struct Result {
+        // Saturates at the maximum uint64_t.
+        uint64_t solutions = 0;
+        // For each piece, the squares it covers in at least one
+        // solution.
+        std::array<SquareSet, G::N> cover;
+        // The number of independent groups of pieces in the puzzle.
+        int components = 0;
+        int64_t nodes = 0;
+        // False if the search gave up after max_nodes.
+        bool complete = true;
+    };
+
+    // Start from the current state of game: each piece must cover the
+    // squares fixed to it and keep to its valid orientations.
+    explicit SolutionSpace(const G& game) {
+        for (int at = 0; at < G::W * G::H; ++at) {
+            dots_[at] = game.dot(at);
+        }
+        for (int piece = 0; piece < G::N; ++piece) {
+            SquareSet own, other;
+            for (int at = 0; at < G::W * G::H; ++at) {
+                int fixed = game.fixed_piece(at);
+                own[at] = fixed == piece;
+                other[at] = fixed >= 0 && fixed != piece;
+            }
+            uint16_t valid_o = game.valid_orientations(piece);
+            for (int o = 0; valid_o >> o; ++o) {
+                if (!(valid_o & (1 << o))) {
+                    continue;
+                }
+                SquareSet squares = game.orientation_squares(piece, o);
+                if ((squares & other).none() && (own & ~squares).none()) {
+                    placements_[piece].push_back(squares);
+                }
+            }
+        }
+    }
+
+    Result analyze(int64_t max_nodes) {
+        max_nodes_ = max_nodes;
+        Result ret;
+        uint64_t all = ~uint64_t(0) >> (64 - G::N);
+        std::vector<uint64_t> groups;
+        if (split(all, SquareSet(), dots_, &groups)) {
+            ret.components = groups.size();
+            ret.solutions = 1;
+            for (uint64_t group : groups) {
+                combine(count(group, SquareSet(), dots_), &ret);
+            }
+        }
+        if (!ret.solutions) {
+            ret.cover = {};
+        }
+        ret.complete = complete_;
+        ret.nodes = nodes_;
+        return ret;
+    }
+
+private:
+    struct Part {
+        uint64_t solutions = 0;
+        std::array<SquareSet, G::N> cover;
+    };
+
+    static uint64_t saturating_add(uint64_t a, uint64_t b) {
+        return a + b < a ? std::numeric_limits<uint64_t>::max() : a + b;
+    }
+
+    static uint64_t saturating_mul(uint64_t a, uint64_t b) {
+        if (a && b > std::numeric_limits<uint64_t>::max() / a) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        return a * b;
+    }
+
+    // Multiply in the solutions of an independent group.
+    template <class T>
+    static void combine(const Part& part, T* into) {
+        into->solutions = saturating_mul(into->solutions, part.solutions);
+        for (int piece = 0; piece < G::N; ++piece) {
+            into->cover[piece] |= part.cover[piece];
+        }
+    }
+
+    bool fits(int piece, int i, const SquareSet& taken) const {
+        return (placements_[piece][i] & taken).none();
+    }
+
+    // Split the pieces into groups with no square that pieces from two
+    // groups could cover, given the squares already taken. Returns
+    // false if some piece has no room left or some dot can't be
+    // covered.
+    bool split(uint64_t pieces, const SquareSet& taken,
+               const SquareSet& dots, std::vector<uint64_t>* groups) const {
+        std::array<int, G::N> parent;
+        std::iota(parent.begin(), parent.end(), 0);
+        auto find = [&parent] (int piece) {
+            while (parent[piece] != piece) {
+                piece = parent[piece] = parent[parent[piece]];
+            }
+            return piece;
+        };
+
+        std::array<SquareSet, G::N> reach;
+        SquareSet all_reach;
+        for (int piece = 0; piece < G::N; ++piece) {
+            if (!(pieces & (uint64_t(1) << piece))) {
+                continue;
+            }
+            for (int i = 0; i < placements_[piece].size(); ++i) {
+                if (fits(piece, i, taken)) {
+                    reach[piece] |= placements_[piece][i];
+                }
+            }
+            if (reach[piece].none()) {
+                return false;
+            }
+            for (int other = 0; other < piece; ++other) {
+                if ((pieces & (uint64_t(1) << other)) &&
+                    (reach[piece] & reach[other]).any()) {
+                    parent[find(piece)] = find(other);
+                }
+            }
+            all_reach |= reach[piece];
+        }
+        if ((dots & ~all_reach).any()) {
+            return false;
+        }
+
+        std::array<uint64_t, G::N> group_of = { 0 };
+        for (int piece = 0; piece < G::N; ++piece) {
+            if (pieces & (uint64_t(1) << piece)) {
+                group_of[find(piece)] |= uint64_t(1) << piece;
+            }
+        }
+        groups->clear();
+        for (uint64_t group : group_of) {
+            if (group) {
+                groups->push_back(group);
+            }
+        }
+        return true;
+    }
+
+    // The dots in reach of a group, which no other group can cover.
+    SquareSet group_dots(uint64_t group, const SquareSet& taken,
+                         const SquareSet& dots) const {
+        SquareSet reach;
+        for (int piece = 0; piece < G::N; ++piece) {
+            if (!(group & (uint64_t(1) << piece))) {
+                continue;
+            }
+            for (int i = 0; i < placements_[piece].size(); ++i) {
+                if (fits(piece, i, taken)) {
+                    reach |= placements_[piece][i];
+                }
+            }
+        }
+        return dots & reach;
+    }
+
+    // Solve one group of pieces, which must cover the dots in its
+    // reach.
+    Part count(uint64_t group, const SquareSet& taken,
+               const SquareSet& dots) {
+        Part ret;
+        if (!group) {
+            ret.solutions = dots.none();
+            return ret;
+        }
+        if (++nodes_ > max_nodes_) {
+            complete_ = false;
+            return ret;
+        }
+        SquareSet own_dots = group_dots(group, taken, dots);
+
+        // Branch on the piece with the fewest placements left.
+        int best = -1;
+        int best_count = 0;
+        for (int piece = 0; piece < G::N; ++piece) {
+            if (!(group & (uint64_t(1) << piece))) {
+                continue;
+            }
+            int count = 0;
+            for (int i = 0; i < placements_[piece].size(); ++i) {
+                count += fits(piece, i, taken);
+            }
+            if (best < 0 || count < best_count) {
+                best = piece;
+                best_count = count;
+            }
+        }
+
+        uint64_t rest = group & ~(uint64_t(1) << best);
+        std::vector<uint64_t> groups;
+        for (int i = 0; i < placements_[best].size(); ++i) {
+            if (!fits(best, i, taken)) {
+                continue;
+            }
+            const SquareSet& placement = placements_[best][i];
+            SquareSet now_taken = taken | placement;
+            SquareSet now_dots = own_dots & ~placement;
+            if (!split(rest, now_taken, now_dots, &groups)) {
+                continue;
+            }
+            Part part;
+            part.solutions = 1;
+            for (uint64_t sub : groups) {
+                combine(count(sub, now_taken, now_dots), &part);
+                if (!part.solutions) {
+                    break;
+                }
+            }
+            if (!part.solutions) {
+                continue;
+            }
+            ret.solutions = saturating_add(ret.solutions, part.solutions);
+            for (int piece = 0; piece < G::N; ++piece) {
+                ret.cover[piece] |= part.cover[piece];
+            }
+            ret.cover[best] |= placement;
+        }
+        return ret;
+    }
+
+    std::array<std::vector<SquareSet>, G::N> placements_;
+    SquareSet dots_;
+    int64_t max_nodes_ = 0;
+    int64_t nodes_ = 0;
+    bool complete_ = true;
+};
+
+#endif // LINJAT_SOLUTION_SPACE_H
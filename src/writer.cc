@@ -0,0 +1,100 @@
+#include "writer.h"
+
+#include <cstdlib>
+#include <set>
+
+OutputWriter output_writer;
+
+BufferStream::BufferStream()
+    : fp_(open_memstream(&data_, &size_)) {
+    if (!fp_) {
+        perror("open_memstream");
+        exit(1);
+    }
+}
+
+BufferStream::~BufferStream() {
+    fclose(fp_);
+    free(data_);
+}
+
+std::string BufferStream::take() {
+    fflush(fp_);
+    std::string ret(data_, size_);
+    fseeko(fp_, 0, SEEK_SET);
+    return ret;
+}
+
+OutputWriter::~OutputWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    queued_cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void OutputWriter::write(FILE* fp, std::string data) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!thread_.joinable()) {
+            thread_ = std::thread(&OutputWriter::run, this);
+        }
+        queue_.emplace_back(fp, std::move(data));
+        last_queued_[fp] = ++queued_;
+    }
+    queued_cond_.notify_one();
+}
+
+void OutputWriter::flush(FILE* fp) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = last_queued_.find(fp);
+    if (it == last_queued_.end()) {
+        lock.unlock();
+        fflush(fp);
+        return;
+    }
+    uint64_t last = it->second;
+    written_cond_.wait(lock, [&] { return written_ >= last; });
+}
+
+void OutputWriter::run() {
+    std::vector<std::pair<FILE*, std::string>> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_cond_.wait(lock, [&] {
+                    return stopping_ || !queue_.empty();
+                });
+            if (queue_.empty()) {
+                return;
+            }
+            batch.swap(queue_);
+        }
+
+        // Join consecutive chunks for the same stream.
+        std::set<FILE*> streams;
+        std::string data;
+        for (int i = 0; i < batch.size(); ++i) {
+            FILE* fp = batch[i].first;
+            data += batch[i].second;
+            if (i + 1 == batch.size() || batch[i + 1].first != fp) {
+                fwrite(data.data(), 1, data.size(), fp);
+                streams.insert(fp);
+                data.clear();
+            }
+        }
+        for (FILE* fp : streams) {
+            fflush(fp);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            written_ += batch.size();
+        }
+        written_cond_.notify_all();
+        batch.clear();
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef LINJAT_WRITER_H
+#define LINJAT_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A stdio stream into memory, so that output can be formatted with the
+// usual print functions and then handed to the OutputWriter in one
+// piece.
+class BufferStream {
+public:
+    BufferStream();
+    ~BufferStream();
+
+    FILE* fp() {
+        return fp_;
+    }
+
+    // Everything printed since the last call.
+    std::string take();
+
+private:
+    FILE* fp_;
+    char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// A thread that does the writes for all generator threads. Writes to
+// each stream happen in the order they were queued, and whatever has
+// piled up for a stream while the previous batch was being written
+// goes out with a single fwrite(), so the generator threads never wait
+// on stdio locks or the disk except in flush().
+class OutputWriter {
+public:
+    ~OutputWriter();
+
+    // Queue data to be written to fp.
+    void write(FILE* fp, std::string data);
+
+    // Wait until everything queued for fp has been written and flushed.
+    void flush(FILE* fp);
+
+private:
+    void run();
+
+    std::mutex mutex_;
+    // Signaled when something is queued, and when a batch is done.
+    std::condition_variable queued_cond_;
+    std::condition_variable written_cond_;
+    std::vector<std::pair<FILE*, std::string>> queue_;
+    // Chunks queued and written so far, and the number of the last one
+    // queued for each stream.
+    uint64_t queued_ = 0;
+    uint64_t written_ = 0;
+    std::map<FILE*, uint64_t> last_queued_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+// Started on the first write, and flushed and stopped at exit.
+extern OutputWriter output_writer;
+
+#endif // LINJAT_WRITER_H
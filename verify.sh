@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Classify every puzzle in puzzledb/ again and compare with the golden
+# classifications in regression/. Fails if any classification changed.
+#
+# With MAX_SLOWDOWN set (e.g. 0.3), also fails if the throughput per
+# thread dropped by more than that fraction compared to the first run
+# on this machine, recorded in the untracked RATES directory. Delete
+# it to take a new baseline.
+#
+# After an intentional change to the solver, run with UPDATE=1 to
+# rewrite the golden files.
+
+MAX_SLOWDOWN=${MAX_SLOWDOWN:-0}
+RATES=${RATES:-.verify_rates}
+mkdir -p regression $RATES
+
+status=0
+built=""
+for F in puzzledb/h=*; do
+    B=$(basename $F)
+    H=$(echo $B | sed 's/^h=\([0-9]*\)_.*/\1/')
+    W=$(echo $B | sed 's/.*_w=\([0-9]*\)_.*/\1/')
+    P=$(echo $B | sed 's/.*_p=\([0-9]*\)_.*/\1/')
+    if [ "$built" != "$H $W $P" ]; then
+        (MAP_HEIGHT=$H MAP_WIDTH=$W PIECES=$P cmake . && make) > /dev/null || exit 1
+        built="$H $W $P"
+    fi
+    if [ -n "$UPDATE" ]; then
+        bin/mklinjat --verify_db=$F --verify_golden=regression/$B --verify_update_golden > /dev/null || status=1
+    else
+        echo -n "$B: "
+        bin/mklinjat --verify_db=$F --verify_golden=regression/$B --verify_rate_file=$RATES/$B --verify_max_slowdown=$MAX_SLOWDOWN || status=1
+    fi
+done
+
+exit $status